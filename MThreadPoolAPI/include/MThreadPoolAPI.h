@@ -38,10 +38,45 @@
 #  endif
 #endif
 
-#define MTHREADPOOL_NS MThreadPool_r1
+#define MTHREADPOOL_NS MThreadPool_r2
 
+#include <cstddef>
 #include <cstdlib>
 #include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+///////////////////////////////////////////////////////////////////////////////
+
+namespace MTHREADPOOL_NS
+{
+	static const uint32_t POOL_FLAG_WORK_STEALING = 0x00000001; // <-- Tasks scheduled from a worker thread go to that worker's own deque
+	static const uint32_t POOL_FLAG_COOPERATIVE_WAIT = 0x00000002; // <-- Threads blocked in wait() execute queued tasks until their target completes
+	static const uint32_t POOL_FLAG_PIN_COMPACT = 0x00000004;      // <-- Workers are pinned to the SMT siblings and cores of one package, before the next package is used
+	static const uint32_t POOL_FLAG_PIN_SCATTER = 0x00000008;      // <-- Workers are pinned round-robin across packages and cores, SMT siblings are used last
+	static const uint32_t POOL_FLAG_PIN_CORES = 0x00000010;        // <-- Workers are pinned to one logical processor per physical core
+	static const uint32_t POOL_FLAG_NUMA = 0x00000020;             // <-- Workers are grouped by NUMA node, each node has its own queue for tasks of normal priority
+	static const uint32_t POOL_FLAG_ASYNC_LISTENERS = 0x00000040;  // <-- Listeners are called from a dispatcher thread, in batches and with a short delay; the task may be gone by then
+	static const uint32_t POOL_FLAG_TRACE = 0x00000080;            // <-- Records a timeline of the most recent events per worker; needs a build with MTHREADPOOL_TRACE defined
+
+	static const uint32_t TASK_PRIORITY_LOW = 0;
+	static const uint32_t TASK_PRIORITY_NORMAL = 1;
+	static const uint32_t TASK_PRIORITY_HIGH = 2;
+	static const uint32_t TASK_PRIORITY_COUNT = 3;
+
+	static const uint32_t LATENCY_QUEUE_WAIT = 0; // <-- From scheduling (or the timer firing) until the task starts to run
+	static const uint32_t LATENCY_RUN_TIME = 1;   // <-- Time spent in the task's run() method
+	static const uint32_t LATENCY_KIND_COUNT = 2;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // Interfaces
@@ -49,13 +84,34 @@
 
 namespace MTHREADPOOL_NS
 {
+	class ThreadPool;
+
+	template<typename R>
+	class Future;
+
 	class MTHREADPOOL_DLL ITask
 	{
+		friend class MTHREADPOOL_NS::ThreadPool;
+
 	public:
-		ITask(void) {}
+		ITask(void) : m_state(0), m_queued(0) {}
+		ITask(const ITask &other) : m_state(other.m_state.load() & STATE_OWNED), m_queued(0) {}
 		virtual ~ITask(void) {}
 
+		ITask &operator=(const ITask&) { return *this; }
+
 		virtual void run(void) = 0; // <-- Must be implemented in user code!
+
+	protected:
+		explicit ITask(const bool &poolOwned) : m_state(poolOwned ? uint32_t(STATE_OWNED) : uint32_t(0)), m_queued(0) {} // <-- Pool-owned tasks are disposed only after their waiters have been released
+
+		bool isCancelled(void) const; // <-- May be polled by run(), becomes true once the running task has been cancelled
+		virtual void dispose(void) {} // <-- Called once the pool no longer references the task
+
+	private:
+		static const uint32_t STATE_OWNED = 0x80000000;
+		std::atomic<uint32_t> m_state; // <-- Completion state, owned by the pool
+		uint32_t m_queued;             // <-- Time at which the task was queued (microseconds, wraps around), owned by the pool
 	};
 
 	class MTHREADPOOL_DLL IListener
@@ -68,6 +124,66 @@ namespace MTHREADPOOL_NS
 		virtual void taskFinished(MTHREADPOOL_NS::ITask *const task) = 0; // <-- Must be implemented in user code!
 	};
 
+	class MTHREADPOOL_DLL ITaskGraph
+	{
+	public:
+		ITaskGraph(void) {}
+		virtual ~ITaskGraph(void) {}
+
+		virtual bool addTask(MTHREADPOOL_NS::ITask *const task) = 0;
+		virtual bool addDependency(MTHREADPOOL_NS::ITask *const predecessor, MTHREADPOOL_NS::ITask *const successor) = 0; // <-- "successor" will not start before "predecessor" has finished
+		virtual bool clear(void) = 0;
+	};
+
+	struct PoolConfig
+	{
+		PoolConfig(void) : spinCount(0), yieldCount(0), maxThreadCount(0), keepAlive(0), spawnLatency(0) {}
+
+		uint32_t spinCount;      // <-- Idle workers poll this many times, with a pause in between, before they yield
+		uint32_t yieldCount;     // <-- Idle workers yield this many times before they park; both zero means they park right away
+		uint32_t maxThreadCount; // <-- A value above the pool's thread count makes the pool grow while tasks wait in the queue
+		uint32_t keepAlive;      // <-- Milliseconds after which the extra workers of a growing pool retire when idle (default: 30000)
+		uint32_t spawnLatency;   // <-- Milliseconds that a task may wait in the queue before the pool grows by one more worker (default: 2)
+	};
+
+	struct WorkerStats
+	{
+		bool alive;              // <-- The slot currently has a thread; spare slots are used by elastic pools and blocking regions
+		bool running;            // <-- The worker is inside of a task's run() method
+		uint64_t tasksCompleted; // <-- Tasks that returned from run()
+		uint64_t tasksFailed;    // <-- Tasks that threw an exception from run()
+		uint64_t tasksStolen;    // <-- Tasks taken from the deque of another worker
+		uint64_t busyTime;       // <-- Microseconds spent in run()
+		uint64_t idleTime;       // <-- Microseconds spent spinning or parked while there was nothing to do
+	};
+
+	struct PoolStats
+	{
+		uint64_t tasksScheduled;      // <-- Includes each run of a periodic task
+		uint64_t tasksCompleted;
+		uint64_t tasksFailed;
+		uint64_t tasksCancelled;      // <-- Tasks that were dropped before they got to run
+		uint64_t tasksStolen;
+		uint64_t scheduleBlockedTime; // <-- Microseconds that schedule() spent waiting for a free slot, summed over all callers
+		uint32_t pendingTasks;        // <-- Tasks that have been scheduled, but have not finished yet, including delayed ones
+		uint32_t queueDepth;          // <-- Tasks currently waiting in the queues and deques
+		uint32_t runningTasks;
+		uint32_t threadCount;
+		std::vector<WorkerStats> workers; // <-- One entry per worker slot
+	};
+
+	struct LatencyStats
+	{
+		uint64_t count;
+		uint64_t mean; // <-- All values in nanoseconds; except for the mean, they are accurate to within 1/16
+		uint64_t min;
+		uint64_t max;
+		uint64_t p50;
+		uint64_t p90;
+		uint64_t p99;
+		uint64_t p999;
+	};
+
 	class MTHREADPOOL_DLL IPool
 	{
 	public:
@@ -77,12 +193,634 @@ namespace MTHREADPOOL_NS
 		virtual bool schedule(MTHREADPOOL_NS::ITask *const task) = 0;
 		virtual bool trySchedule(MTHREADPOOL_NS::ITask *const task) = 0;
 
+		virtual bool schedule(MTHREADPOOL_NS::ITask *const task, const uint32_t &priority) = 0; // <-- Higher bands are always served first, but waiting tasks age
+		virtual bool trySchedule(MTHREADPOOL_NS::ITask *const task, const uint32_t &priority) = 0;
+
+		virtual bool scheduleBatch(MTHREADPOOL_NS::ITask *const *const tasks, const size_t &count) = 0;
+		virtual bool tryScheduleBatch(MTHREADPOOL_NS::ITask *const *const tasks, const size_t &count, size_t &scheduled) = 0; // <-- "scheduled" receives the number of leading tasks that were taken
+
+		virtual bool scheduleOnNode(MTHREADPOOL_NS::ITask *const task, const uint32_t &node) = 0; // <-- Normal priority, the task goes to the queue of the given NUMA node, if the pool has one
+
+		virtual bool scheduleGraph(MTHREADPOOL_NS::ITaskGraph *const graph) = 0; // <-- A graph can be scheduled again, once it has completed
+
+		virtual bool scheduleAfter(MTHREADPOOL_NS::ITask *const task, const uint32_t &delay) = 0; // <-- Delay in milliseconds, the task counts as pending right away
+		virtual bool scheduleEvery(MTHREADPOOL_NS::ITask *const task, const uint32_t &period) = 0; // <-- Period in milliseconds, a run is skipped while the previous one is still pending
+
+		virtual bool cancel(MTHREADPOOL_NS::ITask *const task) = 0; // <-- A queued task is dropped without running once it is dequeued, a running task gets to see isCancelled()
+
 		virtual bool wait(void) = 0;
-		virtual bool wait(MTHREADPOOL_NS::ITask *const task) = 0;
+		virtual bool wait(MTHREADPOOL_NS::ITask *const task) = 0; // <-- May be called from within a task; a worker that has to block is compensated, as in a BlockingRegion
+		virtual bool wait(MTHREADPOOL_NS::ITaskGraph *const graph) = 0;
+
+		virtual bool runPending(void) = 0; // <-- Executes one pending task on the calling thread, returns false if there was none
+		virtual bool runPendingWhile(const std::atomic<uint32_t> &counter) = 0; // <-- Executes pending tasks until "counter" drops to zero, sleeps while there is nothing to do; a task must finish after each decrement
+		virtual bool enterBlocking(void) = 0; // <-- Called by a task before it blocks, so that a spare worker can take over; prefer BlockingRegion
+		virtual bool leaveBlocking(void) = 0;
+		virtual uint32_t getThreadCount(void) const = 0; // <-- Number of workers that are currently alive
+		virtual uint32_t getNodeCount(void) const = 0;
+		virtual bool getStats(MTHREADPOOL_NS::PoolStats &stats) const = 0; // <-- The counters are read one by one, so the snapshot is not atomic as a whole
+		virtual bool getLatency(const uint32_t &kind, MTHREADPOOL_NS::LatencyStats &stats) const = 0; // <-- Covers all tasks since the pool was created; queue waits have a resolution of one microsecond
+		virtual bool dumpTrace(const char *const fileName) const = 0; // <-- Chrome Trace Event JSON, for chrome://tracing or ui.perfetto.dev; also written at destruction, if MTHREADPOOL_TRACE_FILE is set
 
 		virtual bool addListener(MTHREADPOOL_NS::IListener *const listener) = 0;
-		virtual bool removeListener(MTHREADPOOL_NS::IListener *const listener) = 0;
+		virtual bool removeListener(MTHREADPOOL_NS::IListener *const listener) = 0; // <-- Once this returns, the listener is not called anymore; must not be called from within a callback
+
+		virtual void *allocateTaskMemory(const size_t &size) = 0;
+		virtual void releaseTaskMemory(void *const memory, const size_t &size) = 0;
+
+		template<typename F>
+		typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type schedule(F &&function);
+
+		template<typename F>
+		typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type trySchedule(F &&function);
+
+		template<typename F>
+		typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type schedule(F &&function, const uint32_t &priority);
+
+		template<typename F>
+		typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type trySchedule(F &&function, const uint32_t &priority);
+
+		template<typename F>
+		MTHREADPOOL_NS::Future<typename std::decay<typename std::result_of<F()>::type>::type> submit(F &&function);
+
+	protected:
+		template<typename F>
+		bool scheduleFunction(F &&function, const bool &blocking, const uint32_t &priority);
+	};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Templates
+///////////////////////////////////////////////////////////////////////////////
+
+namespace MTHREADPOOL_NS
+{
+	class BlockingRegion
+	{
+	public:
+		BlockingRegion(IPool *const pool) : m_pool(pool), m_entered(pool->enterBlocking()) {} // <-- Does nothing, unless the calling thread is one of the pool's workers
+		~BlockingRegion(void) { if(m_entered) m_pool->leaveBlocking(); }
+
+	private:
+		BlockingRegion(const BlockingRegion&) = delete;
+		BlockingRegion &operator=(const BlockingRegion&) = delete;
+
+		IPool *const m_pool;
+		const bool m_entered;
+	};
+
+	//The pool's task memory is aligned like malloc(), an over-aligned task gets a block of its own that is aligned by hand
+	template<typename T, bool OVER_ALIGNED = (std::alignment_of<T>::value > std::alignment_of<std::max_align_t>::value)>
+	class TaskMemory
+	{
+	public:
+		static_assert(std::alignment_of<T>::value <= std::alignment_of<std::max_align_t>::value, "Task is over-aligned!");
+
+		static void *allocate(IPool *const pool)
+		{
+			return pool->allocateTaskMemory(sizeof(T));
+		}
+
+		static void release(IPool *const pool, void *const memory)
+		{
+			pool->releaseTaskMemory(memory, sizeof(T));
+		}
+	};
+
+	template<typename T>
+	class TaskMemory<T, true>
+	{
+	public:
+		static void *allocate(IPool *const)
+		{
+			static const size_t ALIGNMENT = std::alignment_of<T>::value;
+			void *const block = ::operator new(sizeof(T) + sizeof(void*) + ALIGNMENT - 1, std::nothrow);
+			if(!block)
+			{
+				return NULL;
+			}
+
+			//The start of the block is kept right in front of the aligned address
+			const uintptr_t address = (reinterpret_cast<uintptr_t>(block) + sizeof(void*) + ALIGNMENT - 1) & (~uintptr_t(ALIGNMENT - 1));
+			reinterpret_cast<void**>(address)[-1] = block;
+			return reinterpret_cast<void*>(address);
+		}
+
+		static void release(IPool *const, void *const memory)
+		{
+			if(memory)
+			{
+				::operator delete(static_cast<void**>(memory)[-1]);
+			}
+		}
+	};
+
+	template<typename F>
+	class FunctionTask : public ITask
+	{
+	public:
+		template<typename G>
+		FunctionTask(IPool *const pool, G &&function) : ITask(true), m_pool(pool), m_function(std::forward<G>(function)) {}
+
+		virtual void run(void)
+		{
+			m_function();
+		}
+
+	protected:
+		virtual void dispose(void)
+		{
+			IPool *const pool = m_pool;
+			this->~FunctionTask();
+			TaskMemory<FunctionTask>::release(pool, this);
+		}
+
+		IPool *const m_pool;
+		F m_function;
+	};
+
+	template<typename R>
+	class ResultSlot
+	{
+	public:
+		ResultSlot(void) : m_hasValue(false) {}
+		~ResultSlot(void) { if(m_hasValue) reinterpret_cast<R*>(&m_storage)->~R(); }
+
+		template<typename F>
+		void set(F &function)
+		{
+			new(&m_storage) R(function());
+			m_hasValue = true;
+		}
+
+		R take(void)
+		{
+			return std::move(*reinterpret_cast<R*>(&m_storage));
+		}
+
+	private:
+		typename std::aligned_storage<sizeof(R), std::alignment_of<R>::value>::type m_storage;
+		bool m_hasValue;
+	};
+
+	template<>
+	class ResultSlot<void>
+	{
+	public:
+		template<typename F>
+		void set(F &function)
+		{
+			function();
+		}
+
+		void take(void) {}
+	};
+
+	template<typename R>
+	class FutureTask : public ITask
+	{
+		friend class MTHREADPOOL_NS::Future<R>;
+
+	public:
+		FutureTask(IPool *const pool) : ITask(true), m_pool(pool), m_refCount(2), m_disposed(false), m_finished(false) {} // <-- One reference for the pool, one for the future
+
+		void release(void)
+		{
+			if(m_refCount.fetch_sub(1) == 1)
+			{
+				destroy();
+			}
+		}
+
+	protected:
+		virtual void dispose(void)
+		{
+			m_disposed.store(true, std::memory_order_release);
+			release();
+		}
+
+		virtual void destroy(void) = 0;
+
+		bool detached(void) const // <-- The pool is done with the task, it must not be asked about it anymore
+		{
+			return m_disposed.load(std::memory_order_acquire);
+		}
+
+		IPool *const m_pool;
+		std::atomic<uint32_t> m_refCount;
+		std::atomic<bool> m_disposed;
+		std::exception_ptr m_exception;
+		ResultSlot<R> m_result;
+		bool m_finished;
+	};
+
+	template<typename R, typename F>
+	class FutureFunctionTask : public FutureTask<R>
+	{
+	public:
+		template<typename G>
+		FutureFunctionTask(IPool *const pool, G &&function) : FutureTask<R>(pool), m_function(std::forward<G>(function)) {}
+
+		virtual void run(void)
+		{
+			try
+			{
+				this->m_result.set(m_function);
+			}
+			catch(...)
+			{
+				this->m_exception = std::current_exception();
+			}
+			this->m_finished = true;
+		}
+
+	protected:
+		virtual void destroy(void)
+		{
+			this->~FutureFunctionTask();
+			::operator delete(this);
+		}
+
+		F m_function;
+	};
+
+	//A future may outlive its pool: the task's memory does not come from the pool, and once the pool has finished (or dropped) the
+	//task, it is not referenced anymore. What a future must not do is race with destroyPool(), e.g. wait() from another thread.
+	template<typename R>
+	class Future
+	{
+	public:
+		Future(void) : m_task(NULL) {}
+		explicit Future(FutureTask<R> *const task) : m_task(task) {}
+		Future(Future &&other) : m_task(other.m_task) { other.m_task = NULL; }
+		~Future(void) { reset(); }
+
+		Future &operator=(Future &&other)
+		{
+			if(this != &other)
+			{
+				reset();
+				m_task = other.m_task;
+				other.m_task = NULL;
+			}
+			return *this;
+		}
+
+		bool valid(void) const
+		{
+			return (m_task != NULL);
+		}
+
+		bool wait(void) const
+		{
+			return m_task ? (m_task->detached() || m_task->m_pool->wait(m_task)) : false;
+		}
+
+		bool cancel(void) const
+		{
+			return (m_task && (!m_task->detached())) ? m_task->m_pool->cancel(m_task) : false;
+		}
+
+		R get(void) // <-- Re-throws the exception, if the task has failed or has been cancelled (or dropped by destroyPool) before it ran; the future becomes invalid afterwards
+		{
+			if(!m_task)
+			{
+				throw std::logic_error("Future is not valid!");
+			}
+
+			wait();
+			Holder holder(m_task);
+			m_task = NULL;
+
+			if(holder.task->m_exception)
+			{
+				std::rethrow_exception(holder.task->m_exception);
+			}
+
+			if(!holder.task->m_finished)
+			{
+				throw std::runtime_error("Task has been cancelled!");
+			}
+
+			return holder.task->m_result.take();
+		}
+
+	private:
+		Future(const Future&) = delete;
+		Future &operator=(const Future&) = delete;
+
+		struct Holder
+		{
+			Holder(FutureTask<R> *const t) : task(t) {}
+			~Holder(void) { task->release(); }
+			FutureTask<R> *const task;
+		};
+
+		void reset(void)
+		{
+			if(m_task)
+			{
+				m_task->release();
+				m_task = NULL;
+			}
+		}
+
+		FutureTask<R> *m_task;
+	};
+
+	template<typename F>
+	typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type IPool::schedule(F &&function)
+	{
+		return scheduleFunction(std::forward<F>(function), true, TASK_PRIORITY_NORMAL);
+	}
+
+	template<typename F>
+	typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type IPool::trySchedule(F &&function)
+	{
+		return scheduleFunction(std::forward<F>(function), false, TASK_PRIORITY_NORMAL);
+	}
+
+	template<typename F>
+	typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type IPool::schedule(F &&function, const uint32_t &priority)
+	{
+		return scheduleFunction(std::forward<F>(function), true, priority);
+	}
+
+	template<typename F>
+	typename std::enable_if<!std::is_convertible<F, MTHREADPOOL_NS::ITask*>::value, bool>::type IPool::trySchedule(F &&function, const uint32_t &priority)
+	{
+		return scheduleFunction(std::forward<F>(function), false, priority);
+	}
+
+	template<typename F>
+	bool IPool::scheduleFunction(F &&function, const bool &blocking, const uint32_t &priority)
+	{
+		typedef FunctionTask<typename std::decay<F>::type> task_t;
+
+		void *const memory = TaskMemory<task_t>::allocate(this);
+		if(!memory)
+		{
+			return false;
+		}
+
+		task_t *task = NULL;
+		try
+		{
+			task = new(memory) task_t(this, std::forward<F>(function));
+		}
+		catch(...)
+		{
+			TaskMemory<task_t>::release(this, memory);
+			return false;
+		}
+
+		const bool scheduled = blocking ? schedule(static_cast<MTHREADPOOL_NS::ITask*>(task), priority) : trySchedule(static_cast<MTHREADPOOL_NS::ITask*>(task), priority);
+		if(!scheduled)
+		{
+			task->~task_t();
+			TaskMemory<task_t>::release(this, memory);
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename F>
+	MTHREADPOOL_NS::Future<typename std::decay<typename std::result_of<F()>::type>::type> IPool::submit(F &&function)
+	{
+		typedef typename std::decay<typename std::result_of<F()>::type>::type result_t;
+		typedef FutureFunctionTask<result_t, typename std::decay<F>::type> task_t;
+		static_assert(std::alignment_of<task_t>::value <= std::alignment_of<std::max_align_t>::value, "Callable is over-aligned!");
+
+		//Unlike fire-and-forget tasks, these are not taken from the pool's allocator, because the future may hold on to them for longer
+		void *const memory = ::operator new(sizeof(task_t), std::nothrow);
+		if(!memory)
+		{
+			return Future<result_t>();
+		}
+
+		task_t *task = NULL;
+		try
+		{
+			task = new(memory) task_t(this, std::forward<F>(function));
+		}
+		catch(...)
+		{
+			::operator delete(memory);
+			return Future<result_t>();
+		}
+
+		if(!schedule(static_cast<MTHREADPOOL_NS::ITask*>(task)))
+		{
+			task->~task_t();
+			::operator delete(memory);
+			return Future<result_t>();
+		}
+
+		return Future<result_t>(task);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Algorithms
+///////////////////////////////////////////////////////////////////////////////
+
+namespace MTHREADPOOL_NS
+{
+	class ParallelContext
+	{
+	public:
+		static const uint32_t LEAVES_PER_THREAD = 64; // <-- Used to derive the grain size, if none was specified
+		static const uint32_t STOLEN_DEPTH = 2;       // <-- Additional split levels for a range that was stolen by another thread
+
+		ParallelContext(IPool *const threadPool, const size_t &count, const size_t &grainSize) : pool(threadPool), failed(false)
+		{
+			const size_t threadCount = std::max<size_t>(threadPool->getThreadCount(), 1);
+			grain = grainSize ? grainSize : std::max<size_t>(count / (threadCount * LEAVES_PER_THREAD), 1);
+			depth = 3;
+			for(size_t n = 1; n < threadCount; n <<= 1)
+			{
+				depth++;
+			}
+		}
+
+		void fail(void)
+		{
+			if(!failed.exchange(true))
+			{
+				exception = std::current_exception();
+			}
+		}
+
+		void rethrow(void) const
+		{
+			if(exception)
+			{
+				std::rethrow_exception(exception);
+			}
+		}
+
+		IPool *const pool;
+		size_t grain;
+		uint32_t depth;
+		std::atomic<bool> failed;
+		std::exception_ptr exception;
+	};
+
+	class ParallelJoin
+	{
+	public:
+		ParallelJoin(IPool *const pool) : m_pool(pool), m_pending(0) {}
+		~ParallelJoin(void) { wait(); }
+
+		void add(void) { m_pending.fetch_add(1); }
+		void done(void) { m_pending.fetch_sub(1, std::memory_order_release); }
+
+		void wait(void) // <-- Instead of blocking, the calling thread helps with pending tasks; it only sleeps once there are none left
+		{
+			while(m_pending.load(std::memory_order_acquire) > 0)
+			{
+				if(!m_pool->runPendingWhile(m_pending))
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+	private:
+		IPool *const m_pool;
+		std::atomic<uint32_t> m_pending;
+	};
+
+	class ParallelDone
+	{
+	public:
+		ParallelDone(ParallelJoin &join) : m_join(join) {}
+		~ParallelDone(void) { m_join.done(); }
+
+	private:
+		ParallelDone &operator=(const ParallelDone&) = delete;
+		ParallelJoin &m_join;
 	};
+
+	template<typename Body>
+	void parallelForRange(ParallelContext &context, const Body &body, size_t begin, size_t end, uint32_t depth)
+	{
+		const std::thread::id owner = std::this_thread::get_id();
+		ParallelJoin join(context.pool);
+
+		try
+		{
+			//Split off the upper half for as long as the range is large enough, the lower half stays with us
+			while(((end - begin) > context.grain) && (depth > 0) && (!context.failed.load()))
+			{
+				const size_t middle = begin + ((end - begin) / 2), upper = end;
+				const uint32_t nextDepth = --depth;
+				ParallelJoin *const parent = &join;
+				ParallelContext *const ctx = &context;
+				const Body *const fn = &body;
+
+				join.add();
+				const bool spawned = context.pool->trySchedule([ctx, fn, parent, middle, upper, nextDepth, owner]()
+				{
+					ParallelDone done(*parent);
+					const bool stolen = (std::this_thread::get_id() != owner);
+					parallelForRange(*ctx, *fn, middle, upper, stolen ? (nextDepth + ParallelContext::STOLEN_DEPTH) : nextDepth);
+				});
+
+				if(!spawned)
+				{
+					join.done();
+					break; /*queue is full, so there is no point in splitting any further*/
+				}
+
+				end = middle;
+			}
+
+			if(!context.failed.load())
+			{
+				body(begin, end);
+			}
+		}
+		catch(...)
+		{
+			context.fail();
+		}
+	}
+
+	template<typename T, typename Body, typename Combine>
+	T parallelReduceRange(ParallelContext &context, const T &identity, const Body &body, const Combine &combine, size_t begin, size_t end, uint32_t depth)
+	{
+		if(((end - begin) <= context.grain) || (depth == 0) || context.failed.load())
+		{
+			return body(begin, end, identity);
+		}
+
+		const std::thread::id owner = std::this_thread::get_id();
+		const size_t middle = begin + ((end - begin) / 2);
+		const uint32_t nextDepth = depth - 1;
+
+		T upperResult(identity);
+		ParallelJoin join(context.pool);
+		T *const result = &upperResult;
+		ParallelJoin *const parent = &join;
+		ParallelContext *const ctx = &context;
+		const T *const init = &identity;
+		const Body *const fn = &body;
+		const Combine *const cb = &combine;
+
+		join.add();
+		const bool spawned = context.pool->trySchedule([ctx, init, fn, cb, result, parent, middle, end, nextDepth, owner]()
+		{
+			ParallelDone done(*parent);
+			try
+			{
+				const bool stolen = (std::this_thread::get_id() != owner);
+				*result = parallelReduceRange(*ctx, *init, *fn, *cb, middle, end, stolen ? (nextDepth + ParallelContext::STOLEN_DEPTH) : nextDepth);
+			}
+			catch(...)
+			{
+				ctx->fail();
+			}
+		});
+
+		if(!spawned)
+		{
+			join.done();
+			upperResult = parallelReduceRange(context, identity, body, combine, middle, end, nextDepth);
+		}
+
+		const T lowerResult = parallelReduceRange(context, identity, body, combine, begin, middle, nextDepth);
+		join.wait();
+
+		return combine(lowerResult, upperResult);
+	}
+
+	template<typename Body>
+	void parallelFor(IPool *const pool, const size_t &begin, const size_t &end, const Body &body, const size_t &grainSize = 0) // <-- Calls body(first, last) for sub-ranges; re-throws the first exception
+	{
+		if(end > begin)
+		{
+			ParallelContext context(pool, end - begin, grainSize);
+			parallelForRange(context, body, begin, end, context.depth);
+			context.rethrow();
+		}
+	}
+
+	template<typename T, typename Body, typename Combine>
+	T parallelReduce(IPool *const pool, const size_t &begin, const size_t &end, const T &identity, const Body &body, const Combine &combine, const size_t &grainSize = 0) // <-- Calls body(first, last, identity) for sub-ranges and merges results with combine(lower, upper)
+	{
+		if(end <= begin)
+		{
+			return identity;
+		}
+
+		ParallelContext context(pool, end - begin, grainSize);
+		const T result = parallelReduceRange(context, identity, body, combine, begin, end, context.depth);
+		context.rethrow();
+
+		return result;
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -91,8 +829,10 @@ namespace MTHREADPOOL_NS
 
 namespace MTHREADPOOL_NS
 {
-	IPool MTHREADPOOL_DLL *allocatePool(const uint32_t &threadCount = 0, const uint32_t &maxQueueLength = 0);
+	IPool MTHREADPOOL_DLL *allocatePool(const uint32_t &threadCount = 0, const uint32_t &maxQueueLength = 0, const uint32_t &flags = 0, const PoolConfig &config = PoolConfig());
 	bool MTHREADPOOL_DLL destroyPool(IPool *pool);
+	ITaskGraph MTHREADPOOL_DLL *allocateGraph(void);
+	bool MTHREADPOOL_DLL destroyGraph(ITaskGraph *graph);
 	const char MTHREADPOOL_DLL *getVersionInfo(uint32_t &vMajor, uint32_t &vMinor, uint32_t &vPatch, bool &bDebug);
 }
 
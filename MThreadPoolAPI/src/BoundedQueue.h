@@ -0,0 +1,220 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Bounded MPMC queue (D. Vyukov), every cell carries a sequence number
+	///////////////////////////////////////////////////////////////////////////
+
+	template<typename T>
+	class BoundedQueue
+	{
+	public:
+		BoundedQueue(const uint32_t &capacity)
+		{
+			m_capacity = 2;
+			while(m_capacity < capacity)
+			{
+				m_capacity <<= 1;
+			}
+
+			m_mask = m_capacity - 1;
+			m_buffer = new Cell[m_capacity];
+
+			for(size_t i = 0; i < m_capacity; i++)
+			{
+				m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+			}
+
+			m_enqueuePos.store(0, std::memory_order_relaxed);
+			m_dequeuePos.store(0, std::memory_order_relaxed);
+		}
+
+		~BoundedQueue(void)
+		{
+			delete [] m_buffer;
+		}
+
+		inline bool tryEnqueue(const T &value)
+		{
+			Cell *cell;
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+			for(;;)
+			{
+				cell = &m_buffer[pos & m_mask];
+				const size_t seq = cell->sequence.load(std::memory_order_acquire);
+				const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+				if(diff == 0)
+				{
+					if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if(diff < 0)
+				{
+					return false; /*queue is full*/
+				}
+				else
+				{
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->data = value;
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		inline bool tryEnqueueBulk(const T *const values, const size_t &count)
+		{
+			if(count > m_capacity)
+			{
+				return false;
+			}
+
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+			for(;;)
+			{
+				//All cells in the range must be free; then the whole range is claimed with a single CAS
+				size_t ready = 0;
+				while(ready < count)
+				{
+					const size_t seq = m_buffer[(pos + ready) & m_mask].sequence.load(std::memory_order_acquire);
+					if(seq != (pos + ready))
+					{
+						break;
+					}
+					ready++;
+				}
+
+				if(ready < count)
+				{
+					const size_t current = m_enqueuePos.load(std::memory_order_relaxed);
+					if(current == pos)
+					{
+						return false; /*not enough room*/
+					}
+					pos = current;
+					continue;
+				}
+
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+
+			for(size_t i = 0; i < count; i++)
+			{
+				Cell *const cell = &m_buffer[(pos + i) & m_mask];
+				cell->data = values[i];
+				cell->sequence.store(pos + i + 1, std::memory_order_release);
+			}
+
+			return true;
+		}
+
+		inline bool tryDequeue(T &value)
+		{
+			Cell *cell;
+			size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+			for(;;)
+			{
+				cell = &m_buffer[pos & m_mask];
+				const size_t seq = cell->sequence.load(std::memory_order_acquire);
+				const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+
+				if(diff == 0)
+				{
+					if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if(diff < 0)
+				{
+					return false; /*queue is empty*/
+				}
+				else
+				{
+					pos = m_dequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			value = cell->data;
+			cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		inline size_t size(void) const
+		{
+			const size_t head = m_dequeuePos.load(std::memory_order_relaxed);
+			const size_t tail = m_enqueuePos.load(std::memory_order_relaxed);
+			return (tail > head) ? (tail - head) : 0;
+		}
+
+		inline bool empty(void) const
+		{
+			return (size() == 0);
+		}
+
+		inline size_t capacity(void) const
+		{
+			return m_capacity;
+		}
+
+	private:
+		BoundedQueue(const BoundedQueue&) = delete;
+		BoundedQueue &operator=(const BoundedQueue&) = delete;
+
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		static const size_t CACHE_LINE = 64;
+
+		char m_pad0[CACHE_LINE];
+		Cell *m_buffer;
+		size_t m_mask;
+		size_t m_capacity;
+		char m_pad1[CACHE_LINE];
+		std::atomic<size_t> m_enqueuePos;
+		char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> m_dequeuePos;
+		char m_pad3[CACHE_LINE - sizeof(std::atomic<size_t>)];
+	};
+}
@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MThreadPoolAPI.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Log-linear histogram (HDR style): 16 sub-buckets per power of two
+	///////////////////////////////////////////////////////////////////////////
+
+	class LatencyHistogram
+	{
+	public:
+		static const uint32_t SUB_BITS = 4;
+		static const uint32_t SUB_COUNT = 1U << SUB_BITS;
+		static const uint32_t MAX_BITS = 40; /*values from 2^40 ns (about 18 minutes) on end up in the last bucket*/
+		static const uint32_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+		LatencyHistogram(void)
+		{
+			for(uint32_t i = 0; i < BUCKET_COUNT; i++)
+			{
+				m_buckets[i] = 0;
+			}
+			m_sum = 0;
+		}
+
+		inline void record(const uint64_t &value)
+		{
+			m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		inline void mergeInto(std::vector<uint64_t> &counts, uint64_t &sum) const
+		{
+			for(uint32_t i = 0; i < BUCKET_COUNT; i++)
+			{
+				counts[i] += m_buckets[i].load(std::memory_order_relaxed);
+			}
+			sum += m_sum.load(std::memory_order_relaxed);
+		}
+
+		static inline uint32_t bucketOf(const uint64_t &value)
+		{
+			if(value < SUB_COUNT)
+			{
+				return uint32_t(value);
+			}
+
+			//The top bits below the most significant one select the sub-bucket, so the relative error stays below 1/16
+			const uint32_t msb = mostSignificantBit(value);
+			if(msb >= MAX_BITS)
+			{
+				return BUCKET_COUNT - 1;
+			}
+
+			return ((msb - SUB_BITS + 1) << SUB_BITS) + uint32_t((value >> (msb - SUB_BITS)) - SUB_COUNT);
+		}
+
+		static inline uint64_t lowestValue(const uint32_t &bucket)
+		{
+			if(bucket < SUB_COUNT)
+			{
+				return bucket;
+			}
+
+			const uint32_t shift = (bucket >> SUB_BITS) - 1;
+			return uint64_t(SUB_COUNT + (bucket & (SUB_COUNT - 1))) << shift;
+		}
+
+		static inline uint64_t highestValue(const uint32_t &bucket)
+		{
+			return (bucket < SUB_COUNT) ? bucket : (lowestValue(bucket) + (uint64_t(1) << ((bucket >> SUB_BITS) - 1)) - 1);
+		}
+
+	private:
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram &operator=(const LatencyHistogram&) = delete;
+
+		static inline uint32_t mostSignificantBit(const uint64_t &value)
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanReverse64(&index, value);
+			return uint32_t(index);
+#elif defined(__GNUC__)
+			return uint32_t(63 - __builtin_clzll(value));
+#else
+			uint32_t index = 0;
+			for(uint64_t v = value; v >>= 1;)
+			{
+				index++;
+			}
+			return index;
+#endif
+		}
+
+		std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+		std::atomic<uint64_t> m_sum;
+	};
+}
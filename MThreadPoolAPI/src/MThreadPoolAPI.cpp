@@ -23,6 +23,7 @@
 
 #include "MThreadPoolAPI.h"
 #include "ThreadPool.h"
+#include "TaskGraph.h"
 
 using namespace MTHREADPOOL_NS;
 
@@ -30,8 +31,8 @@ using namespace MTHREADPOOL_NS;
 // Constants
 ///////////////////////////////////////////////////////////////////////////////
 
-static const uint32_t MTHREADPOOL_VERSION_MAJOR = 1;
-static const uint32_t MTHREADPOOL_VERSION_MINOR = 1;
+static const uint32_t MTHREADPOOL_VERSION_MAJOR = 2;
+static const uint32_t MTHREADPOOL_VERSION_MINOR = 0;
 static const uint32_t MTHREADPOOL_VERSION_PATCH = 0;
 
 static const char *MTHREADPOOL_VERSION_DATE = __DATE__;
@@ -46,13 +47,13 @@ static const bool MTHREADPOOL_VERSION_DEBUG = true;
 // Allocate new pool
 ///////////////////////////////////////////////////////////////////////////////
 
-IPool *MTHREADPOOL_NS::allocatePool(const uint32_t &threadCount, const uint32_t &maxQueueLength)
+IPool *MTHREADPOOL_NS::allocatePool(const uint32_t &threadCount, const uint32_t &maxQueueLength, const uint32_t &flags, const PoolConfig &config)
 {
 	IPool *pool = NULL;
 
 	try
 	{
-		pool = new ThreadPool(threadCount, maxQueueLength);
+		pool = new ThreadPool(threadCount, maxQueueLength, flags, config);
 	}
 	catch(...)
 	{
@@ -86,6 +87,50 @@ bool MTHREADPOOL_NS::destroyPool(IPool *pool)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Allocate new task graph
+///////////////////////////////////////////////////////////////////////////////
+
+ITaskGraph *MTHREADPOOL_NS::allocateGraph(void)
+{
+	ITaskGraph *graph = NULL;
+
+	try
+	{
+		graph = new TaskGraph();
+	}
+	catch(...)
+	{
+		graph = NULL;
+	}
+
+	return graph;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Destroy task graph
+///////////////////////////////////////////////////////////////////////////////
+
+bool MTHREADPOOL_NS::destroyGraph(ITaskGraph *graph)
+{
+	try
+	{
+		if(graph)
+		{
+			delete graph;
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	catch(...)
+	{
+		return false;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Version info
 ///////////////////////////////////////////////////////////////////////////////
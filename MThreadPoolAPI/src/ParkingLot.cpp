@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ParkingLot.h"
+#include "ThreadUtils.h"
+
+#include <climits>
+
+using namespace MTHREADPOOL_NS;
+
+///////////////////////////////////////////////////////////////////////////////
+// Spin-then-park wait
+///////////////////////////////////////////////////////////////////////////////
+
+void ParkingLot::waitWhile(std::atomic<uint32_t> *const address, const uint32_t &busyMask, const uint32_t &waitersFlag, const uint32_t &spinCount)
+{
+	uint32_t state = address->load(std::memory_order_acquire);
+
+	//Spin for a while, short operations are likely to complete before a sleep/wake-up round trip would
+	for(uint32_t spin = 0; (state & busyMask) && (spin < spinCount); spin++)
+	{
+		MTHREAD_PAUSE();
+		state = address->load(std::memory_order_acquire);
+	}
+
+	while(state & busyMask)
+	{
+		//Announce ourselves as a waiter, so that the releasing thread knows it must wake us
+		if(!(state & waitersFlag))
+		{
+			if(!address->compare_exchange_weak(state, state | waitersFlag))
+			{
+				continue;
+			}
+			state |= waitersFlag;
+		}
+
+		park(address, state);
+		state = address->load(std::memory_order_acquire);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LINUX
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+void ParkingLot::park(std::atomic<uint32_t> *const address, const uint32_t &expected)
+{
+	//Returns immediately, if the value has already changed; spurious wake-ups are handled by the caller
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+bool ParkingLot::park(std::atomic<uint32_t> *const address, const uint32_t &expected, const uint32_t &timeout)
+{
+	//FUTEX_WAIT takes a relative time-out, measured against CLOCK_MONOTONIC
+	struct timespec relative;
+	relative.tv_sec = static_cast<time_t>(timeout / 1000U);
+	relative.tv_nsec = static_cast<long>(timeout % 1000U) * 1000000L;
+
+	if(syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAIT_PRIVATE, expected, &relative, NULL, 0) != 0)
+	{
+		return (errno != ETIMEDOUT);
+	}
+	return true;
+}
+
+void ParkingLot::unpark(std::atomic<uint32_t> *const address, const uint32_t count)
+{
+	const int wakeCount = (count > uint32_t(INT_MAX)) ? INT_MAX : int(count);
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAKE_PRIVATE, wakeCount, NULL, NULL, 0);
+}
+
+#endif //__linux__
+
+///////////////////////////////////////////////////////////////////////////////
+// GENERIC
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __linux__
+
+static const size_t BUCKET_COUNT = 64;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+}
+bucket_t;
+
+static bucket_t g_buckets[BUCKET_COUNT];
+static pthread_once_t g_bucketsOnce = PTHREAD_ONCE_INIT;
+
+static void PTW32_CDECL initBuckets(void)
+{
+	for(size_t i = 0; i < BUCKET_COUNT; i++)
+	{
+		pthread_mutex_init(&g_buckets[i].lock, NULL);
+		pthread_cond_init(&g_buckets[i].cond, NULL);
+	}
+}
+
+static inline bucket_t *getBucket(const void *const address)
+{
+	pthread_once(&g_bucketsOnce, initBuckets);
+	const size_t hash = (reinterpret_cast<size_t>(address) >> 4) * 2654435761U;
+	return &g_buckets[(hash >> 8) % BUCKET_COUNT];
+}
+
+void ParkingLot::park(std::atomic<uint32_t> *const address, const uint32_t &expected)
+{
+	bucket_t *const bucket = getBucket(address);
+	MTHREAD_MUTEX_LOCK(&bucket->lock);
+
+	//Waking threads take the bucket lock, so we can not miss the wake-up once we have checked the value
+	if(address->load() == expected)
+	{
+		MTHREAD_COND_WAIT(&bucket->cond, &bucket->lock);
+	}
+
+	MTHREAD_MUTEX_UNLOCK(&bucket->lock);
+}
+
+bool ParkingLot::park(std::atomic<uint32_t> *const address, const uint32_t &expected, const uint32_t &timeout)
+{
+	const long long deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + (timeout * 1000000LL);
+	struct timespec abstime;
+	abstime.tv_sec = static_cast<time_t>(deadline / 1000000000LL);
+	abstime.tv_nsec = static_cast<long>(deadline % 1000000000LL);
+
+	bucket_t *const bucket = getBucket(address);
+	MTHREAD_MUTEX_LOCK(&bucket->lock);
+
+	int error = 0;
+	if(address->load() == expected)
+	{
+		error = pthread_cond_timedwait(&bucket->cond, &bucket->lock, &abstime);
+	}
+
+	MTHREAD_MUTEX_UNLOCK(&bucket->lock);
+	return (error != ETIMEDOUT);
+}
+
+void ParkingLot::unpark(std::atomic<uint32_t> *const address, const uint32_t count)
+{
+	bucket_t *const bucket = getBucket(address);
+	MTHREAD_MUTEX_LOCK(&bucket->lock);
+
+	//The bucket may be shared by other addresses, so all waiters have to re-check their value
+	MTHREAD_COND_BROADCAST(&bucket->cond);
+
+	MTHREAD_MUTEX_UNLOCK(&bucket->lock);
+}
+
+#endif //__linux__
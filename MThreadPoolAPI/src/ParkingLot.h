@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MThreadPoolAPI.h"
+
+#include <atomic>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Address-based parking: futex on Linux, hashed wait buckets elsewhere
+	///////////////////////////////////////////////////////////////////////////
+
+	class ParkingLot
+	{
+	public:
+		static const uint32_t WAKE_ALL = UINT32_MAX;
+
+		static void park(std::atomic<uint32_t> *const address, const uint32_t &expected);
+		static bool park(std::atomic<uint32_t> *const address, const uint32_t &expected, const uint32_t &timeout); /*milliseconds, returns false on time-out*/
+		static void unpark(std::atomic<uint32_t> *const address, const uint32_t count = WAKE_ALL);
+
+		static void waitWhile(std::atomic<uint32_t> *const address, const uint32_t &busyMask, const uint32_t &waitersFlag, const uint32_t &spinCount);
+
+	private:
+		ParkingLot(void) = delete;
+	};
+}
@@ -24,8 +24,13 @@
 #include "PlatformSupport.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
 
-#define LOG(X, ...) fprintf(stderr, "[MThreadPool] " X "\n", __VA_ARGS__)
+#define LOG(X, ...) fprintf(stderr, "[MThreadPool] " X "\n", ##__VA_ARGS__)
 
 ///////////////////////////////////////////////////////////////////////////////
 // WIN32
@@ -65,6 +70,142 @@ namespace MTHREADPOOL_NS
 	
 		return numberOfProcessors;
 	}
+
+	uint32_t getProcessorQuota(const char *const /*root*/)
+	{
+		return 0; /*CPU rate limits of job objects are not supported yet*/
+	}
+
+	bool getProcessorTopology(std::vector<cpu_info_t> &topology)
+	{
+		topology.clear();
+
+		DWORD_PTR affinityMaskPrc = 0, affinityMaskSys = 0;
+		if(!GetProcessAffinityMask(GetCurrentProcess(), &affinityMaskPrc, &affinityMaskSys))
+		{
+			LOG("Failed to determine processor topology!");
+			return false;
+		}
+
+		DWORD length = 0;
+		GetLogicalProcessorInformation(NULL, &length);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+		if(info.empty() || (!GetLogicalProcessorInformation(&info[0], &length)))
+		{
+			info.clear(); /*every processor is treated as a core of its own*/
+		}
+
+		//Start out with the defaults, then fill in whatever the system tells us
+		static const uint32_t MAX_CPUS = 8 * sizeof(DWORD_PTR);
+		cpu_info_t cpus[MAX_CPUS];
+		for(uint32_t i = 0; i < MAX_CPUS; i++)
+		{
+			UCHAR node = 0;
+			cpus[i].cpu = cpus[i].core = cpus[i].cacheL2 = cpus[i].cacheL3 = i;
+			cpus[i].package = cpus[i].thread = 0;
+			cpus[i].node = GetNumaProcessorNode(UCHAR(i), &node) ? uint32_t(node) : 0;
+		}
+
+		uint32_t coreIndex = 0, packageIndex = 0;
+		for(size_t i = 0; i < info.size(); i++)
+		{
+			uint32_t lowest = MAX_CPUS, rank = 0;
+			for(uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+			{
+				if(!(info[i].ProcessorMask & (DWORD_PTR(1) << cpu)))
+				{
+					continue;
+				}
+				lowest = std::min(lowest, cpu);
+				switch(info[i].Relationship)
+				{
+				case RelationProcessorCore:
+					cpus[cpu].core = coreIndex;
+					cpus[cpu].thread = rank++;
+					break;
+				case RelationProcessorPackage:
+					cpus[cpu].package = packageIndex;
+					break;
+				case RelationCache:
+					if((info[i].Cache.Type != CacheInstruction) && (info[i].Cache.Level == 2)) cpus[cpu].cacheL2 = lowest;
+					if((info[i].Cache.Type != CacheInstruction) && (info[i].Cache.Level == 3)) cpus[cpu].cacheL3 = lowest;
+					break;
+				default:
+					break;
+				}
+			}
+			if(info[i].Relationship == RelationProcessorCore) coreIndex++;
+			if(info[i].Relationship == RelationProcessorPackage) packageIndex++;
+		}
+
+		for(uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+		{
+			if(affinityMaskPrc & (DWORD_PTR(1) << cpu))
+			{
+				topology.push_back(cpus[cpu]);
+			}
+		}
+
+		return !topology.empty();
+	}
+
+	bool setThreadAffinity(const uint32_t &cpu)
+	{
+		if((cpu >= (8 * sizeof(DWORD_PTR))) || (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu)))
+		{
+			LOG("Failed to set thread affinity to CPU #%u!", cpu);
+			return false;
+		}
+		return true;
+	}
+
+	bool setThreadAffinity(const std::vector<uint32_t> &cpus)
+	{
+		DWORD_PTR affinityMask = 0;
+		for(size_t i = 0; i < cpus.size(); i++)
+		{
+			if(cpus[i] < (8 * sizeof(DWORD_PTR))) affinityMask |= (DWORD_PTR(1) << cpus[i]);
+		}
+
+		if((!affinityMask) || (!SetThreadAffinityMask(GetCurrentThread(), affinityMask)))
+		{
+			LOG("Failed to set thread affinity!");
+			return false;
+		}
+		return true;
+	}
+
+	bool getThreadAffinity(std::vector<uint32_t> &cpus)
+	{
+		cpus.clear();
+
+		//There is no "get" function, but setting the mask returns the previous one
+		const HANDLE thread = GetCurrentThread();
+		DWORD_PTR affinityMaskPrc = 0, affinityMaskSys = 0;
+		if(!GetProcessAffinityMask(GetCurrentProcess(), &affinityMaskPrc, &affinityMaskSys))
+		{
+			return false;
+		}
+
+		const DWORD_PTR affinityMask = SetThreadAffinityMask(thread, affinityMaskPrc);
+		if(!affinityMask)
+		{
+			return false;
+		}
+		SetThreadAffinityMask(thread, affinityMask);
+
+		for(uint32_t cpu = 0; cpu < (8 * sizeof(DWORD_PTR)); cpu++)
+		{
+			if(affinityMask & (DWORD_PTR(1) << cpu)) cpus.push_back(cpu);
+		}
+		return true;
+	}
+
+	bool getCurrentProcessor(uint32_t &cpu)
+	{
+		cpu = GetCurrentProcessorNumber();
+		return true;
+	}
 }
 
 #endif //_WIN32
@@ -101,6 +242,13 @@ namespace MTHREADPOOL_NS
 			numberOfProcessors = 1;
 		}
 
+		//Inside of a container, the CFS quota may allow for much less than the affinity mask suggests
+		const uint32_t quota = getProcessorQuota();
+		if(quota && (quota < numberOfProcessors))
+		{
+			numberOfProcessors = quota;
+		}
+
 		//If no CPU found, enforce at least one!
 		if(numberOfProcessors < 1)
 		{
@@ -109,6 +257,426 @@ namespace MTHREADPOOL_NS
 	
 		return numberOfProcessors;
 	}
+
+	static uint32_t quotaToProcessors(const long long &quota, const long long &period)
+	{
+		//A partial processor still needs a thread of its own
+		return ((quota > 0) && (period > 0)) ? uint32_t((quota + period - 1) / period) : 0;
+	}
+
+	static bool findCgroup(const std::string &root, const bool &unified, std::string &path)
+	{
+		FILE *const file = fopen((root + "/proc/self/cgroup").c_str(), "r");
+		if(!file)
+		{
+			return false;
+		}
+
+		//Lines look like "0::/path" for cgroup v2 and like "4:cpu,cpuacct:/path" for cgroup v1
+		bool found = false;
+		char line[1024];
+		while((!found) && fgets(line, sizeof(line), file))
+		{
+			char *const controllers = strchr(line, ':');
+			char *const location = controllers ? strchr(controllers + 1, ':') : NULL;
+			if(!location)
+			{
+				continue;
+			}
+			*location = '\0';
+			location[strcspn(location + 1, "\r\n") + 1] = '\0';
+
+			if(unified)
+			{
+				found = (controllers[1] == '\0');
+			}
+			else
+			{
+				for(char *token = strtok(controllers + 1, ","); token && (!found); token = strtok(NULL, ","))
+				{
+					found = (strcmp(token, "cpu") == 0);
+				}
+			}
+
+			if(found)
+			{
+				path = location + 1;
+			}
+		}
+
+		fclose(file);
+		return found;
+	}
+
+	static uint32_t readCgroupQuota(const char *const mount, const std::string &cgroup, const bool &unified)
+	{
+		uint32_t result = 0;
+		std::string current(cgroup);
+
+		//The effective limit is the tightest one along the way up to the root of the hierarchy
+		for(;;)
+		{
+			const char *const relative = (current == "/") ? "" : current.c_str();
+			char path[1024];
+			long long quota = -1, period = 0;
+
+			if(unified)
+			{
+				snprintf(path, sizeof(path), "%s%s/cpu.max", mount, relative);
+				if(FILE *const file = fopen(path, "r"))
+				{
+					char value[32];
+					if((fscanf(file, "%31s %lld", value, &period) == 2) && (strcmp(value, "max") != 0))
+					{
+						quota = atoll(value);
+					}
+					fclose(file);
+				}
+			}
+			else
+			{
+				snprintf(path, sizeof(path), "%s%s/cpu.cfs_quota_us", mount, relative);
+				if(FILE *const file = fopen(path, "r"))
+				{
+					if(fscanf(file, "%lld", &quota) != 1) quota = -1;
+					fclose(file);
+				}
+				snprintf(path, sizeof(path), "%s%s/cpu.cfs_period_us", mount, relative);
+				if(FILE *const file = fopen(path, "r"))
+				{
+					if(fscanf(file, "%lld", &period) != 1) period = 0;
+					fclose(file);
+				}
+			}
+
+			const uint32_t processors = quotaToProcessors(quota, period);
+			if(processors && ((!result) || (processors < result)))
+			{
+				result = processors;
+			}
+
+			const size_t separator = current.rfind('/');
+			if((current == "/") || current.empty() || (separator == std::string::npos))
+			{
+				break;
+			}
+			current.erase((separator > 0) ? separator : 1);
+		}
+
+		return result;
+	}
+
+	uint32_t getProcessorQuota(const char *const root)
+	{
+		const std::string prefix(root ? root : "");
+		std::string cgroup;
+
+		//Try cgroup v2 first; inside of a cgroup namespace, the path is relative to the container's own cgroup
+		if(findCgroup(prefix, true, cgroup))
+		{
+			if(const uint32_t quota = readCgroupQuota((prefix + "/sys/fs/cgroup").c_str(), cgroup, true))
+			{
+				return quota;
+			}
+		}
+
+		if(findCgroup(prefix, false, cgroup))
+		{
+			static const char *const MOUNTS[] = { "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu", NULL };
+			for(size_t i = 0; MOUNTS[i]; i++)
+			{
+				if(const uint32_t quota = readCgroupQuota((prefix + MOUNTS[i]).c_str(), cgroup, false))
+				{
+					return quota;
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	static bool readSysValue(const uint32_t &cpu, const char *const name, uint32_t &value)
+	{
+		char path[256];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/%s", cpu, name);
+
+		//For CPU lists, such as "0-3,8-11", this yields the lowest processor
+		bool success = false;
+		if(FILE *const file = fopen(path, "r"))
+		{
+			success = (fscanf(file, "%u", &value) == 1);
+			fclose(file);
+		}
+		return success;
+	}
+
+	static bool readSysString(const uint32_t &cpu, const char *const name, char *const buffer, const size_t &size)
+	{
+		char path[256];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/%s", cpu, name);
+
+		bool success = false;
+		if(FILE *const file = fopen(path, "r"))
+		{
+			success = (fgets(buffer, int(size), file) != NULL);
+			fclose(file);
+		}
+		return success;
+	}
+
+	static void parseCpuList(const char *text, std::vector<uint32_t> &values)
+	{
+		//Lists look like "0-3,8-11"
+		while(*text)
+		{
+			char *end = NULL;
+			const unsigned long first = strtoul(text, &end, 10);
+			if(end == text)
+			{
+				break;
+			}
+			unsigned long last = first;
+			if(*end == '-')
+			{
+				text = end + 1;
+				last = strtoul(text, &end, 10);
+			}
+			for(unsigned long value = first; value <= last; value++)
+			{
+				values.push_back(uint32_t(value));
+			}
+			text = (*end == ',') ? (end + 1) : "";
+		}
+	}
+
+	static bool readNodeList(const char *const name, std::vector<uint32_t> &values)
+	{
+		char path[256], buffer[4096];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/%s", name);
+
+		bool success = false;
+		if(FILE *const file = fopen(path, "r"))
+		{
+			if(fgets(buffer, sizeof(buffer), file))
+			{
+				parseCpuList(buffer, values);
+				success = true;
+			}
+			fclose(file);
+		}
+		return success;
+	}
+
+	bool getProcessorTopology(std::vector<cpu_info_t> &topology)
+	{
+		topology.clear();
+
+		//Without NUMA support in the kernel, there is no node directory, and all processors belong to node zero
+		std::map<uint32_t, uint32_t> cpuNode;
+		std::vector<uint32_t> nodes;
+		if(readNodeList("online", nodes))
+		{
+			for(size_t i = 0; i < nodes.size(); i++)
+			{
+				char name[64];
+				std::vector<uint32_t> cpus;
+				snprintf(name, sizeof(name), "node%u/cpulist", nodes[i]);
+				readNodeList(name, cpus);
+				for(size_t j = 0; j < cpus.size(); j++)
+				{
+					cpuNode[cpus[j]] = nodes[i];
+				}
+			}
+		}
+
+		cpu_set_t cpuSet;
+		if(sched_getaffinity(0, sizeof(cpu_set_t), &cpuSet) != 0)
+		{
+			LOG("Failed to determine processor topology!");
+			return false;
+		}
+
+		//The core IDs are only unique within a package, so they are renumbered here
+		std::map<std::pair<uint32_t, uint32_t>, uint32_t> coreIndex;
+		std::map<uint32_t, uint32_t> siblingCount;
+
+		for(uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if(!CPU_ISSET(cpu, &cpuSet))
+			{
+				continue;
+			}
+
+			cpu_info_t info;
+			info.cpu = info.cacheL2 = info.cacheL3 = cpu;
+			info.node = (cpuNode.find(cpu) != cpuNode.end()) ? cpuNode[cpu] : 0;
+
+			uint32_t coreId = cpu;
+			if(!readSysValue(cpu, "topology/physical_package_id", info.package)) info.package = 0;
+			if(!readSysValue(cpu, "topology/core_id", coreId)) coreId = cpu;
+
+			const std::pair<uint32_t, uint32_t> key(info.package, coreId);
+			if(coreIndex.find(key) == coreIndex.end())
+			{
+				const uint32_t index = uint32_t(coreIndex.size());
+				coreIndex[key] = index;
+			}
+			info.core = coreIndex[key];
+			info.thread = siblingCount[info.core]++;
+
+			//Instruction caches are not interesting, we want to know which data is shared
+			for(uint32_t index = 0; ; index++)
+			{
+				char name[64], type[32];
+				uint32_t level = 0, lowest = cpu;
+				snprintf(name, sizeof(name), "cache/index%u/level", index);
+				if(!readSysValue(cpu, name, level))
+				{
+					break;
+				}
+				snprintf(name, sizeof(name), "cache/index%u/type", index);
+				if(readSysString(cpu, name, type, sizeof(type)) && (strncmp(type, "Instruction", 11) == 0))
+				{
+					continue;
+				}
+				snprintf(name, sizeof(name), "cache/index%u/shared_cpu_list", index);
+				if(readSysValue(cpu, name, lowest))
+				{
+					if(level == 2) info.cacheL2 = lowest;
+					if(level == 3) info.cacheL3 = lowest;
+				}
+			}
+
+			topology.push_back(info);
+		}
+
+		return !topology.empty();
+	}
+
+	bool setThreadAffinity(const uint32_t &cpu)
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+
+		//On Linux, PID zero refers to the calling thread rather than the whole process
+		if(sched_setaffinity(0, sizeof(cpu_set_t), &cpuSet) != 0)
+		{
+			LOG("Failed to set thread affinity to CPU #%u!", cpu);
+			return false;
+		}
+		return true;
+	}
+
+	bool setThreadAffinity(const std::vector<uint32_t> &cpus)
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		for(size_t i = 0; i < cpus.size(); i++)
+		{
+			if(cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &cpuSet);
+		}
+
+		if((CPU_COUNT(&cpuSet) < 1) || (sched_setaffinity(0, sizeof(cpu_set_t), &cpuSet) != 0))
+		{
+			LOG("Failed to set thread affinity!");
+			return false;
+		}
+		return true;
+	}
+
+	bool getThreadAffinity(std::vector<uint32_t> &cpus)
+	{
+		cpus.clear();
+
+		cpu_set_t cpuSet;
+		if(sched_getaffinity(0, sizeof(cpu_set_t), &cpuSet) != 0)
+		{
+			return false;
+		}
+
+		for(uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if(CPU_ISSET(cpu, &cpuSet)) cpus.push_back(cpu);
+		}
+		return true;
+	}
+
+	bool getCurrentProcessor(uint32_t &cpu)
+	{
+		const int current = sched_getcpu();
+		if(current < 0)
+		{
+			return false;
+		}
+		cpu = uint32_t(current);
+		return true;
+	}
 }
 
 #endif //__linux__
+
+///////////////////////////////////////////////////////////////////////////////
+// COMMON
+///////////////////////////////////////////////////////////////////////////////
+
+namespace MTHREADPOOL_NS
+{
+	static bool compareCompact(const cpu_info_t &a, const cpu_info_t &b)
+	{
+		if(a.package != b.package) return a.package < b.package;
+		if(a.node != b.node) return a.node < b.node;
+		if(a.cacheL3 != b.cacheL3) return a.cacheL3 < b.cacheL3;
+		if(a.cacheL2 != b.cacheL2) return a.cacheL2 < b.cacheL2;
+		if(a.core != b.core) return a.core < b.core;
+		return a.thread < b.thread;
+	}
+
+	bool getProcessorOrder(const cpu_order_t &order, std::vector<uint32_t> &cpus)
+	{
+		cpus.clear();
+
+		std::vector<cpu_info_t> topology;
+		if(!getProcessorTopology(topology))
+		{
+			return false;
+		}
+
+		std::sort(topology.begin(), topology.end(), compareCompact);
+
+		//For scattering, each core gets its rank within the package, so that the packages take turns
+		std::vector<uint32_t> rank(topology.size(), 0);
+		std::map<uint32_t, uint32_t> coresPerPackage;
+		for(size_t i = 0; i < topology.size(); i++)
+		{
+			const bool firstThread = (i == 0) || (topology[i].core != topology[i - 1].core);
+			rank[i] = firstThread ? coresPerPackage[topology[i].package]++ : rank[i - 1];
+		}
+
+		std::vector<std::pair<uint64_t, uint32_t> > keys;
+		for(size_t i = 0; i < topology.size(); i++)
+		{
+			const cpu_info_t &info = topology[i];
+			switch(order)
+			{
+			case CPU_ORDER_SCATTER:
+				keys.push_back(std::make_pair((uint64_t(info.thread) << 48) | (uint64_t(rank[i]) << 24) | info.package, info.cpu));
+				break;
+			case CPU_ORDER_CORES:
+				if(info.thread == 0) keys.push_back(std::make_pair(uint64_t(i), info.cpu));
+				break;
+			default:
+				keys.push_back(std::make_pair(uint64_t(i), info.cpu));
+				break;
+			}
+		}
+
+		std::sort(keys.begin(), keys.end());
+		for(size_t i = 0; i < keys.size(); i++)
+		{
+			cpus.push_back(keys[i].second);
+		}
+
+		return !cpus.empty();
+	}
+}
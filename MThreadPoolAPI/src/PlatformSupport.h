@@ -25,7 +25,36 @@
 
 #include "MThreadPoolAPI.h"
 
+#include <vector>
+
 namespace MTHREADPOOL_NS
 {
-	uint32_t getNumberOfProcessors(void);
+	typedef struct
+	{
+		uint32_t cpu;     /*logical processor*/
+		uint32_t node;    /*NUMA node*/
+		uint32_t package; /*physical package (socket)*/
+		uint32_t core;    /*physical core, unique across all packages*/
+		uint32_t thread;  /*index among the SMT siblings of the core*/
+		uint32_t cacheL2; /*lowest logical processor that shares the L2 cache*/
+		uint32_t cacheL3; /*lowest logical processor that shares the L3 cache*/
+	}
+	cpu_info_t;
+
+	typedef enum
+	{
+		CPU_ORDER_COMPACT = 0, /*fill up the SMT siblings and cores of one package before moving on to the next*/
+		CPU_ORDER_SCATTER = 1, /*spread over packages and cores first, SMT siblings come last*/
+		CPU_ORDER_CORES   = 2  /*one logical processor per physical core*/
+	}
+	cpu_order_t;
+
+	uint32_t getNumberOfProcessors(void); /*limited by the CPU quota, if any*/
+	uint32_t getProcessorQuota(const char *const root = NULL); /*zero, if there is no quota; "root" is prepended to /proc and /sys paths*/
+	bool getProcessorTopology(std::vector<cpu_info_t> &topology);
+	bool getProcessorOrder(const cpu_order_t &order, std::vector<uint32_t> &cpus);
+	bool setThreadAffinity(const uint32_t &cpu); /*applies to the calling thread*/
+	bool setThreadAffinity(const std::vector<uint32_t> &cpus);
+	bool getThreadAffinity(std::vector<uint32_t> &cpus);
+	bool getCurrentProcessor(uint32_t &cpu);
 }
@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Bounded SPSC ring, exactly one producer and one consumer thread
+	///////////////////////////////////////////////////////////////////////////
+
+	template<typename T>
+	class SpscRing
+	{
+	public:
+		SpscRing(const uint32_t &capacity)
+		{
+			m_capacity = 2;
+			while(m_capacity < capacity)
+			{
+				m_capacity <<= 1;
+			}
+
+			m_mask = m_capacity - 1;
+			m_buffer = new T[m_capacity];
+
+			m_head.store(0, std::memory_order_relaxed);
+			m_tail.store(0, std::memory_order_relaxed);
+			m_cachedHead = 0;
+		}
+
+		~SpscRing(void)
+		{
+			delete [] m_buffer;
+		}
+
+		inline bool tryPush(const T &value) /*producer only*/
+		{
+			const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+			//The consumer's position is only re-read once the ring appears to be full
+			if((tail - m_cachedHead) >= m_capacity)
+			{
+				m_cachedHead = m_head.load(std::memory_order_acquire);
+				if((tail - m_cachedHead) >= m_capacity)
+				{
+					return false; /*ring is full*/
+				}
+			}
+
+			m_buffer[tail & m_mask] = value;
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		inline size_t popBulk(T *const values, const size_t &maxCount) /*consumer only*/
+		{
+			const size_t head = m_head.load(std::memory_order_relaxed);
+			const size_t tail = m_tail.load(std::memory_order_acquire);
+			const size_t count = ((tail - head) < maxCount) ? (tail - head) : maxCount;
+
+			for(size_t i = 0; i < count; i++)
+			{
+				values[i] = m_buffer[(head + i) & m_mask];
+			}
+
+			m_head.store(head + count, std::memory_order_release);
+			return count;
+		}
+
+		inline bool empty(void) const
+		{
+			return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_relaxed);
+		}
+
+	private:
+		SpscRing(const SpscRing&) = delete;
+		SpscRing &operator=(const SpscRing&) = delete;
+
+		static const size_t CACHE_LINE = 64;
+
+		char m_pad0[CACHE_LINE];
+		T *m_buffer;
+		size_t m_mask;
+		size_t m_capacity;
+		char m_pad1[CACHE_LINE];
+		std::atomic<size_t> m_tail;
+		size_t m_cachedHead;
+		char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+		std::atomic<size_t> m_head;
+		char m_pad3[CACHE_LINE - sizeof(std::atomic<size_t>)];
+	};
+}
@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TaskAllocator.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace MTHREADPOOL_NS;
+
+///////////////////////////////////////////////////////////////////////////////
+// Free list
+///////////////////////////////////////////////////////////////////////////////
+
+TaskAllocator::FreeList::FreeList(void)
+{
+	for(size_t i = 0; i < CLASS_COUNT; i++)
+	{
+		m_head[i] = NULL;
+		m_count[i] = 0;
+	}
+}
+
+TaskAllocator::FreeList::~FreeList(void)
+{
+	for(size_t i = 0; i < CLASS_COUNT; i++)
+	{
+		while(void *const block = m_head[i])
+		{
+			m_head[i] = *static_cast<void**>(block);
+			free(block);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor & Destructor
+///////////////////////////////////////////////////////////////////////////////
+
+TaskAllocator::TaskAllocator(const uint32_t &slotCount)
+:
+	m_slotCount(slotCount),
+	m_freeSlots(slotCount)
+{
+	m_slab = static_cast<char*>(malloc(SLOT_SIZE * m_slotCount));
+	if(!m_slab)
+	{
+		throw std::bad_alloc();
+	}
+
+	for(uint32_t i = 0; i < m_slotCount; i++)
+	{
+		m_freeSlots.tryEnqueue(m_slab + (i * SLOT_SIZE));
+	}
+}
+
+TaskAllocator::~TaskAllocator(void)
+{
+	if(m_slab)
+	{
+		free(m_slab);
+		m_slab = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate & Release
+///////////////////////////////////////////////////////////////////////////////
+
+void *TaskAllocator::allocate(const size_t &size, FreeList *const local)
+{
+	void *memory = NULL;
+
+	//Small tasks are served from the shared slots first
+	if((size <= SLOT_SIZE) && m_freeSlots.tryDequeue(memory))
+	{
+		return memory;
+	}
+
+	//Larger tasks (or slot exhaustion) spill to the calling worker's free list
+	const size_t index = sizeClass(size);
+	if(index >= CLASS_COUNT)
+	{
+		return malloc(size);
+	}
+
+	if(local && local->m_head[index])
+	{
+		memory = local->m_head[index];
+		local->m_head[index] = *static_cast<void**>(memory);
+		local->m_count[index]--;
+		return memory;
+	}
+
+	return malloc(SLOT_SIZE << index);
+}
+
+void TaskAllocator::release(void *const memory, const size_t &size, FreeList *const local)
+{
+	if(!memory)
+	{
+		return;
+	}
+
+	char *const address = static_cast<char*>(memory);
+	if((address >= m_slab) && (address < (m_slab + (SLOT_SIZE * m_slotCount))))
+	{
+		m_freeSlots.tryEnqueue(memory);
+		return;
+	}
+
+	const size_t index = sizeClass(size);
+	if(local && (index < CLASS_COUNT) && (local->m_count[index] < MAX_CACHED_BLOCKS))
+	{
+		*static_cast<void**>(memory) = local->m_head[index];
+		local->m_head[index] = memory;
+		local->m_count[index]++;
+		return;
+	}
+
+	free(memory);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal
+///////////////////////////////////////////////////////////////////////////////
+
+size_t TaskAllocator::sizeClass(const size_t &size)
+{
+	size_t index = 0;
+	while((index < CLASS_COUNT) && ((SLOT_SIZE << index) < size))
+	{
+		index++;
+	}
+	return index;
+}
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MThreadPoolAPI.h"
+#include "BoundedQueue.h"
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Memory for pool-owned tasks: fixed-size slots plus per-worker free lists
+	///////////////////////////////////////////////////////////////////////////
+
+	class TaskAllocator
+	{
+	public:
+		static const size_t SLOT_SIZE = 128;
+		static const size_t CLASS_COUNT = 6; /*128 to 4096 bytes*/
+		static const uint32_t MAX_CACHED_BLOCKS = 64;
+
+		class FreeList
+		{
+			friend class TaskAllocator;
+
+		public:
+			FreeList(void);
+			~FreeList(void);
+
+		private:
+			FreeList(const FreeList&) = delete;
+			FreeList &operator=(const FreeList&) = delete;
+
+			void *m_head[CLASS_COUNT];
+			uint32_t m_count[CLASS_COUNT];
+		};
+
+		TaskAllocator(const uint32_t &slotCount);
+		~TaskAllocator(void);
+
+		void *allocate(const size_t &size, FreeList *const local);
+		void release(void *const memory, const size_t &size, FreeList *const local);
+
+	private:
+		TaskAllocator(const TaskAllocator&) = delete;
+		TaskAllocator &operator=(const TaskAllocator&) = delete;
+
+		static inline size_t sizeClass(const size_t &size);
+
+		const uint32_t m_slotCount;
+		char *m_slab;
+		BoundedQueue<void*> m_freeSlots;
+	};
+}
@@ -0,0 +1,354 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TaskGraph.h"
+#include "ThreadPool.h"
+#include "ParkingLot.h"
+
+#include <cstdio>
+
+using namespace MTHREADPOOL_NS;
+
+#define LOG(X, ...) fprintf(stderr, "[MThreadPool] " X "\n", ##__VA_ARGS__)
+
+///////////////////////////////////////////////////////////////////////////////
+// Graph state
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t GRAPH_STATE_RUNNING = 0x00000001;
+static const uint32_t GRAPH_STATE_WAITERS = 0x00000002;
+
+static const uint32_t WAIT_SPIN_COUNT = 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+// Graph node
+///////////////////////////////////////////////////////////////////////////////
+
+TaskGraph::Node::Node(TaskGraph *const graph, ITask *const wrapped)
+:
+	ITask(true),
+	task(wrapped),
+	predecessorCount(0),
+	pending(0),
+	abandoned(false),
+	m_graph(graph)
+{
+}
+
+void TaskGraph::Node::run(void)
+{
+	task->run();
+}
+
+void TaskGraph::Node::dispose(void)
+{
+	m_graph->nodeFinished(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor & Destructor
+///////////////////////////////////////////////////////////////////////////////
+
+TaskGraph::TaskGraph(void)
+:
+	m_validated(false),
+	m_pool(NULL),
+	m_remaining(0),
+	m_state(0)
+{
+}
+
+TaskGraph::~TaskGraph(void)
+{
+	if(isRunning())
+	{
+		LOG("Warning: Graph destroyed while it is still running!");
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the graph
+///////////////////////////////////////////////////////////////////////////////
+
+bool TaskGraph::addTask(ITask *const task)
+{
+	if(isRunning())
+	{
+		LOG("Graph can not be modified while it is running!");
+		return false;
+	}
+
+	try
+	{
+		getNode(task);
+		return true;
+	}
+	catch(...)
+	{
+		LOG("Failed to add task to graph!");
+		return false;
+	}
+}
+
+bool TaskGraph::addDependency(ITask *const predecessor, ITask *const successor)
+{
+	if(isRunning())
+	{
+		LOG("Graph can not be modified while it is running!");
+		return false;
+	}
+
+	if(predecessor == successor)
+	{
+		LOG("Task %p can not depend on itself!", static_cast<void*>(predecessor));
+		return false;
+	}
+
+	try
+	{
+		Node *const from = getNode(predecessor);
+		Node *const to = getNode(successor);
+
+		from->successors.push_back(to);
+		to->predecessorCount++;
+
+		m_validated = false;
+		return true;
+	}
+	catch(...)
+	{
+		LOG("Failed to add dependency to graph!");
+		return false;
+	}
+}
+
+bool TaskGraph::clear(void)
+{
+	if(isRunning())
+	{
+		LOG("Graph can not be modified while it is running!");
+		return false;
+	}
+
+	m_index.clear();
+	m_nodes.clear();
+	m_roots.clear();
+	m_validated = false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Execute the graph
+///////////////////////////////////////////////////////////////////////////////
+
+bool TaskGraph::launch(ThreadPool *const pool)
+{
+	if(!(m_validated || validate()))
+	{
+		return false;
+	}
+
+	uint32_t state = 0;
+	if(!m_state.compare_exchange_strong(state, GRAPH_STATE_RUNNING))
+	{
+		LOG("Graph %p is already running!", static_cast<void*>(this));
+		return false;
+	}
+
+	//Re-arm the predecessor counters, so the same graph can be executed again and again
+	for(std::deque<Node>::iterator iter = m_nodes.begin(); iter != m_nodes.end(); iter++)
+	{
+		iter->pending.store(iter->predecessorCount, std::memory_order_relaxed);
+		iter->abandoned.store(false, std::memory_order_relaxed);
+	}
+
+	m_pool = pool;
+	m_remaining.store(uint32_t(m_nodes.size()));
+
+	if(m_nodes.empty())
+	{
+		m_state.store(0);
+		return true;
+	}
+
+	//Roots are taken in one go for as long as there is room, the rest is scheduled one by one
+	size_t scheduled = 0;
+	if(pool->tryScheduleBatch(&m_roots[0], m_roots.size(), scheduled))
+	{
+		while((scheduled < m_roots.size()) && pool->schedule(m_roots[scheduled]))
+		{
+			scheduled++;
+		}
+	}
+
+	if(scheduled < m_roots.size())
+	{
+		LOG("Failed to schedule %u of %u root tasks of graph %p!", uint32_t(m_roots.size() - scheduled), uint32_t(m_roots.size()), static_cast<void*>(this));
+		abandonRoots(scheduled);
+		return false;
+	}
+
+	return true;
+}
+
+void TaskGraph::wait(void)
+{
+	ParkingLot::waitWhile(&m_state, GRAPH_STATE_RUNNING, GRAPH_STATE_WAITERS, WAIT_SPIN_COUNT);
+}
+
+bool TaskGraph::isRunning(void) const
+{
+	return (m_state.load() & GRAPH_STATE_RUNNING) != 0;
+}
+
+void TaskGraph::nodeFinished(Node *const node)
+{
+	std::vector<Node*> failed;
+
+	//Successors go straight to the finishing worker's own deque, they are likely to use the data we just produced
+	for(std::vector<Node*>::const_iterator iter = node->successors.begin(); iter != node->successors.end(); iter++)
+	{
+		if((*iter)->pending.fetch_sub(1) == 1)
+		{
+			if(!m_pool->scheduleContinuation(*iter))
+			{
+				LOG("Failed to schedule successor %p of task %p!", static_cast<void*>((*iter)->task), static_cast<void*>(node->task));
+				failed.push_back(*iter);
+			}
+		}
+	}
+
+	//A successor that could not be scheduled will never run, and neither will anything that depends on it
+	releaseNodes(failed.empty() ? 1 : (1 + abandonNodes(failed)));
+}
+
+void TaskGraph::releaseNodes(const uint32_t &count)
+{
+	//Whoever accounts for the last node completes the graph, so that it can be waited for and launched again
+	if(m_remaining.fetch_sub(count) == count)
+	{
+		if(m_state.exchange(0) & GRAPH_STATE_WAITERS)
+		{
+			ParkingLot::unpark(&m_state);
+		}
+	}
+}
+
+void TaskGraph::abandonRoots(const size_t &scheduled)
+{
+	std::vector<Node*> stack;
+	for(size_t i = scheduled; i < m_roots.size(); i++)
+	{
+		stack.push_back(static_cast<Node*>(m_roots[i]));
+	}
+
+	//The roots that did get scheduled may still be running, they complete the graph once they are done
+	releaseNodes(abandonNodes(stack));
+}
+
+uint32_t TaskGraph::abandonNodes(std::vector<Node*> &stack)
+{
+	uint32_t count = 0;
+
+	//A node that depends on an abandoned one, directly or not, will never become ready; walks that run concurrently count each node only once
+	while(!stack.empty())
+	{
+		Node *const node = stack.back();
+		stack.pop_back();
+		if(!node->abandoned.exchange(true))
+		{
+			count++;
+			stack.insert(stack.end(), node->successors.begin(), node->successors.end());
+		}
+	}
+
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal
+///////////////////////////////////////////////////////////////////////////////
+
+TaskGraph::Node *TaskGraph::getNode(ITask *const task)
+{
+	std::unordered_map<ITask*, Node*>::iterator iter = m_index.find(task);
+	if(iter != m_index.end())
+	{
+		return iter->second;
+	}
+
+	m_nodes.emplace_back(this, task);
+	Node *const node = &m_nodes.back();
+	m_index.insert(std::make_pair(task, node));
+
+	m_validated = false;
+	return node;
+}
+
+bool TaskGraph::validate(void)
+{
+	std::vector<Node*> ready;
+	std::unordered_map<Node*, uint32_t> inDegree;
+
+	//Kahn's algorithm: the graph must be processed completely, otherwise it contains a cycle
+	m_roots.clear();
+	for(std::deque<Node>::iterator iter = m_nodes.begin(); iter != m_nodes.end(); iter++)
+	{
+		if(iter->predecessorCount == 0)
+		{
+			ready.push_back(&(*iter));
+			m_roots.push_back(&(*iter));
+		}
+		else
+		{
+			inDegree[&(*iter)] = iter->predecessorCount;
+		}
+	}
+
+	size_t visited = 0;
+	while(!ready.empty())
+	{
+		Node *const node = ready.back();
+		ready.pop_back();
+		visited++;
+
+		for(std::vector<Node*>::const_iterator iter = node->successors.begin(); iter != node->successors.end(); iter++)
+		{
+			if(--inDegree[*iter] == 0)
+			{
+				ready.push_back(*iter);
+			}
+		}
+	}
+
+	if(visited != m_nodes.size())
+	{
+		LOG("Graph %p contains a cycle!", static_cast<void*>(this));
+		m_roots.clear();
+		return false;
+	}
+
+	m_validated = true;
+	return true;
+}
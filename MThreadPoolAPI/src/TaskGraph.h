@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MThreadPoolAPI.h"
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+namespace MTHREADPOOL_NS
+{
+	class ThreadPool;
+
+	class TaskGraph : public ITaskGraph
+	{
+	public:
+		TaskGraph(void);
+		virtual ~TaskGraph(void);
+
+		virtual bool addTask(MTHREADPOOL_NS::ITask *const task);
+		virtual bool addDependency(MTHREADPOOL_NS::ITask *const predecessor, MTHREADPOOL_NS::ITask *const successor);
+		virtual bool clear(void);
+
+		bool launch(MTHREADPOOL_NS::ThreadPool *const pool);
+		void wait(void);
+		bool isRunning(void) const;
+
+	private:
+		class Node : public ITask
+		{
+		public:
+			Node(TaskGraph *const graph, MTHREADPOOL_NS::ITask *const wrapped);
+
+			virtual void run(void);
+
+			MTHREADPOOL_NS::ITask *const task;
+			uint32_t predecessorCount;
+			std::atomic<uint32_t> pending;
+			std::atomic<bool> abandoned;
+			std::vector<Node*> successors;
+
+		protected:
+			virtual void dispose(void);
+
+		private:
+			TaskGraph *const m_graph;
+		};
+
+		Node *getNode(MTHREADPOOL_NS::ITask *const task);
+		bool validate(void);
+		void nodeFinished(Node *const node);
+		void releaseNodes(const uint32_t &count);
+		void abandonRoots(const size_t &scheduled);
+		uint32_t abandonNodes(std::vector<Node*> &stack);
+
+		std::deque<Node> m_nodes;
+		std::unordered_map<MTHREADPOOL_NS::ITask*, Node*> m_index;
+		std::vector<MTHREADPOOL_NS::ITask*> m_roots;
+		bool m_validated;
+
+		MTHREADPOOL_NS::ThreadPool *m_pool;
+		std::atomic<uint32_t> m_remaining;
+		std::atomic<uint32_t> m_state;
+	};
+}
@@ -23,9 +23,13 @@
 
 #include "ThreadPool.h"
 
+#include "TaskGraph.h"
 #include "PlatformSupport.h"
+#include "ParkingLot.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <map>
 
 #ifdef _WIN32
 #include <vld.h>
@@ -33,72 +37,262 @@
 
 using namespace MTHREADPOOL_NS;
 
-#define LOG(X, ...) fprintf(stderr, "[MThreadPool] " X "\n", __VA_ARGS__)
+#define LOG(X, ...) fprintf(stderr, "[MThreadPool] " X "\n", ##__VA_ARGS__)
+
+#ifdef MTHREADPOOL_TRACE
+#define TRACE_EVENT(POOL, WORKER, TYPE, TASK, TIME, DURATION, ARG) recordEvent((POOL), (WORKER), (TYPE), (TASK), (TIME), (DURATION), (ARG))
+#else
+#define TRACE_EVENT(POOL, WORKER, TYPE, TASK, TIME, DURATION, ARG) ((void)0)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Task state
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t TASK_STATE_PENDING = 0x00000001;
+static const uint32_t TASK_STATE_WAITERS = 0x00000002;
+static const uint32_t TASK_STATE_CANCELLED = 0x00000004;
+static const uint32_t TASK_STATE_RUNNING = 0x00000008;
+
+static const uint32_t WAIT_SPIN_COUNT = 1024;
+static const uint32_t BATCH_CHUNK_SIZE = 256;
+static const uint32_t AGING_THRESHOLD = 64;
+static const uint32_t NO_NODE = UINT32_MAX;
+
+///////////////////////////////////////////////////////////////////////////////
+// Elastic pool
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t WORKER_STOPPED = 0;
+static const uint32_t WORKER_RUNNING = 1;
+static const uint32_t WORKER_RETIRED = 2;
+
+static const uint32_t DEFAULT_SPAWN_LATENCY = 2; /*milliseconds*/
+static const uint32_t DEFAULT_KEEP_ALIVE = 30000;
+static const uint32_t QUOTA_RECHECK = 1000;
+
+///////////////////////////////////////////////////////////////////////////////
+// Listeners
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t EVENT_RING_SIZE = 4096;
+static const uint32_t DISPATCH_BATCH = 256;
+static const uint32_t DISPATCH_INTERVAL_MIN = 1; /*milliseconds*/
+static const uint32_t DISPATCH_INTERVAL_MAX = 64;
+
+///////////////////////////////////////////////////////////////////////////////
+// Tracing
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint16_t TRACE_QUEUED = 1;
+static const uint16_t TRACE_RUN = 2;
+static const uint16_t TRACE_IDLE = 3;
+static const uint16_t TRACE_STEAL = 4;
+
+static const uint32_t TRACE_BUFFER_SIZE = 16384; /*events per worker*/
+static const uint32_t TRACE_SHARED_THREAD = 0x10000;
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker lookup
+///////////////////////////////////////////////////////////////////////////////
+
+static pthread_once_t g_workerKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t g_workerKey;
+static bool g_workerKeyValid = false;
+
+static void PTW32_CDECL createWorkerKey(void)
+{
+	g_workerKeyValid = (pthread_key_create(&g_workerKey, NULL) == 0);
+}
+
+static inline uint32_t nextRandom(uint32_t &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // Constructor & Destructor
 ///////////////////////////////////////////////////////////////////////////////
 
-ThreadPool::ThreadPool(const uint32_t &threadCount, const uint32_t &maxQueueLength)
+ThreadPool::ThreadPool(const uint32_t &threadCount, const uint32_t &maxQueueLength, const uint32_t &flags, const PoolConfig &config)
 :
-	m_threadCount(threadCount ? threadCount : getNumberOfProcessors()),
-	m_maxQueueLength(std::max((maxQueueLength ? maxQueueLength : (4 * m_threadCount)), m_threadCount))
+	m_minThreads(threadCount ? threadCount : getNumberOfProcessors()),
+	m_threadCount(std::max(config.maxThreadCount, m_minThreads)),
+	m_slotCount(2 * m_threadCount),
+	m_keepAlive(config.keepAlive ? config.keepAlive : DEFAULT_KEEP_ALIVE),
+	m_spawnLatency(config.spawnLatency ? config.spawnLatency : DEFAULT_SPAWN_LATENCY),
+	m_maxQueueLength(std::max((maxQueueLength ? maxQueueLength : (4 * m_threadCount)), m_threadCount)),
+	m_flags(flags),
+	m_spinCount(config.spinCount),
+	m_yieldCount(config.yieldCount),
+	m_timeBase(MTHREAD_TIME_MS()),
+	m_taskAllocator(2 * (m_maxQueueLength + m_threadCount))
 {
 	//LOG("m_threadCount: %u", m_threadCount);
 	//LOG("m_maxQueueLength: %u", m_maxQueueLength);
 	
 	m_bStopFlag = false;
-	m_runningTasks = 0;
-	m_nextCondIndex = 0;
+	m_pendingTasks = 0;
+	m_nextVictim = 0;
+	m_spinning = 0;
+	m_activeThreads = 0;
+	m_idleThreads = 0;
+	m_parkedHelpers = 0;
+	m_helpEpoch = 0;
+	m_lastSpawn = 0;
+	m_blockedThreads = 0;
+	m_surplusThreads = 0;
+	m_cpuQuota = isElastic(this) ? getProcessorQuota() : 0;
+	m_quotaChecked = 0;
+	m_nextTimer = TimerWheel::NO_EXPIRY;
+	m_timerKeeper = false;
+	m_timerRearm = false;
+	resetCounters(m_sharedCounters);
+	m_listenerSnapshot = NULL;
+	m_helperReaders = 0;
+	m_dispatchHazard = NULL;
+	m_dispatchStop = false;
+	m_sharedTrace = NULL;
+	m_traceBase = MTHREAD_TIME_NS();
+
+	//The rings are only there if tracing has been compiled in and is enabled for this pool
+	if(m_flags & POOL_FLAG_TRACE)
+	{
+#ifdef MTHREADPOOL_TRACE
+		m_sharedTrace = new TraceBuffer(TRACE_BUFFER_SIZE);
+#else
+		LOG("Tracing has not been enabled at compile time!");
+#endif
+	}
+
+	//Create one queue per priority band; each one must be able to hold all tasks, since they share the free slots
+	for(uint32_t i = 0; i < TASK_PRIORITY_COUNT; i++)
+	{
+		m_taskQueue[i] = new BoundedQueue<ITask*>(m_maxQueueLength);
+		m_skipCount[i] = 0;
+	}
 
 	//Create the locks
 	MTHREAD_MUTEX_INIT(&m_lockTask);
 	MTHREAD_MUTEX_INIT(&m_lockListeners);
+	MTHREAD_MUTEX_INIT(&m_lockThreads);
+	MTHREAD_MUTEX_INIT(&m_lockTimers);
 
 	//Create semaphores
 	MTHREAD_SEM_INIT(&m_semFree, m_maxQueueLength);
 	MTHREAD_SEM_INIT(&m_semUsed, 0);
+	MTHREAD_SEM_INIT(&m_semDispatch, 0);
 
 	//Create global conditional var
 	MTHREAD_COND_INIT(&m_condAllDone);
 
-	//Allocate per-task conditional vars
-	m_condTaskDone = new pthread_cond_t[m_threadCount + m_maxQueueLength];
-	memset(m_condTaskDone, 0, sizeof(pthread_cond_t) * (m_threadCount + m_maxQueueLength));
-	for(uint32_t i = 0; i < (m_threadCount + m_maxQueueLength); i++)
+	//Create the thread-specific key
+	if((pthread_once(&g_workerKeyOnce, createWorkerKey) != 0) || (!g_workerKeyValid))
+	{
+		throw std::runtime_error("Failed to create thread-specific key!");
+	}
+
+	//Pick the processors for the workers, if they are to be pinned
+	if(m_flags & (POOL_FLAG_PIN_COMPACT | POOL_FLAG_PIN_SCATTER | POOL_FLAG_PIN_CORES))
+	{
+		const cpu_order_t order = (m_flags & POOL_FLAG_PIN_CORES) ? CPU_ORDER_CORES : ((m_flags & POOL_FLAG_PIN_SCATTER) ? CPU_ORDER_SCATTER : CPU_ORDER_COMPACT);
+		if(!getProcessorOrder(order, m_cpuOrder))
+		{
+			LOG("Failed to determine processor order, workers will not be pinned!");
+		}
+	}
+
+	//Set up one queue per NUMA node
+	if(m_flags & POOL_FLAG_NUMA)
+	{
+		setupNodes(this);
+	}
+
+	//Set up the workers; there is a spare slot for each worker, in case that it blocks and needs to be compensated
+	m_workers = new Worker[m_slotCount];
+	for(uint32_t i = 0; i < m_slotCount; i++)
 	{
-		MTHREAD_COND_INIT(&m_condTaskDone[i]);
+		m_workers[i].pool = this;
+		m_workers[i].index = i;
+		m_workers[i].randSeed = 2463534242U + (i * 2654435761U);
+		m_workers[i].listenerHazard = NULL;
+		m_workers[i].events = (m_flags & POOL_FLAG_ASYNC_LISTENERS) ? new SpscRing<ListenerEvent>(EVENT_RING_SIZE) : NULL;
+		m_workers[i].trace = m_sharedTrace ? new TraceBuffer(TRACE_BUFFER_SIZE) : NULL;
+		m_workers[i].status = WORKER_STOPPED;
+		m_workers[i].blockDepth = 0;
+		m_workers[i].compensated = false;
+		m_workers[i].relocated = false;
+		m_workers[i].node = 0;
+		resetCounters(m_workers[i].counters);
+
+		//Pinned workers belong to the node of their processor, all others are spread over the nodes evenly
+		if(!m_nodeQueues.empty())
+		{
+			const uint32_t cpu = m_cpuOrder.empty() ? UINT32_MAX : m_cpuOrder[i % m_cpuOrder.size()];
+			m_workers[i].node = (cpu < m_cpuNode.size()) && (m_cpuNode[cpu] != NO_NODE) ? m_cpuNode[cpu] : (i % uint32_t(m_nodeQueues.size()));
+		}
+	}
+
+	//Create the threads; an elastic pool starts out with the minimum and has room for more
+	m_threads = new pthread_t[m_slotCount];
+	memset(m_threads, 0, sizeof(pthread_t) * m_slotCount);
+	for(uint32_t i = 0; i < m_minThreads; i++)
+	{
+		spawnWorker(this);
 	}
 
-	//Create the threads
-	m_threads = new pthread_t[m_threadCount];
-	memset(m_threads, 0, sizeof(pthread_t) * m_threadCount);
-	for(uint32_t i = 0; i < m_threadCount; i++)
+	//In asynchronous mode, a single thread delivers the events of all workers to the listeners
+	if(m_flags & POOL_FLAG_ASYNC_LISTENERS)
 	{
-		MTHREAD_CREATE(&m_threads[i], NULL, entryPoint, this);
+		MTHREAD_CREATE(&m_dispatcher, NULL, dispatchEntryPoint, this);
 	}
 }
 
 ThreadPool::~ThreadPool(void)
 {
-	MTHREAD_MUTEX_LOCK(&m_lockTask);
+	//Stop all running threads!
+	m_bStopFlag = true;
+	MTHREAD_SEM_POST(&m_semUsed, m_slotCount);
+
+	//Nobody starts a new worker once the stop flag is set, so we only have to wait for a spawn that is in progress
+	MTHREAD_MUTEX_LOCK(&m_lockThreads);
+	MTHREAD_MUTEX_UNLOCK(&m_lockThreads);
 
-	//Do we still have any running/pending tasks?
-	if((!m_taskQueue.empty()) || (m_runningTasks > 0))
+	//Wait for threads to exit, including those that have retired on their own
+	for(uint32_t i = 0; i < m_slotCount; i++)
 	{
-		LOG("Warning: Destructor called while still have running/pending tasks!");
+		if(m_workers[i].status.load() != WORKER_STOPPED)
+		{
+			MTHREAD_JOIN(m_threads[i]);
+			m_workers[i].status.store(WORKER_STOPPED);
+		}
 	}
 
-	MTHREAD_MUTEX_UNLOCK(&m_lockTask);
+	//Do we still have any pending tasks? A task that has returned from run() may have been in finalization until now,
+	//e.g. after its join was released, so only what is left once the workers are gone has really been abandoned
+	if(m_pendingTasks.load() > 0)
+	{
+		LOG("Warning: Destructor called while still have pending tasks!");
+	}
 
-	//Stop all running threads!
-	m_bStopFlag = true;
-	MTHREAD_SEM_POST(&m_semUsed, m_threadCount);
+	//The dispatcher delivers whatever the workers have left in their rings, before it exits
+	if(m_flags & POOL_FLAG_ASYNC_LISTENERS)
+	{
+		m_dispatchStop = true;
+		MTHREAD_SEM_POST(&m_semDispatch);
+		MTHREAD_JOIN(m_dispatcher);
+	}
 
-	//Wait for threads to exit
-	for(uint32_t i = 0; i < m_threadCount; i++)
+	//All workers are gone, so the timeline is complete
+	if(m_sharedTrace)
 	{
-		MTHREAD_JOIN(m_threads[i]);
+		if(const char *const fileName = getenv("MTHREADPOOL_TRACE_FILE"))
+		{
+			dumpTrace(fileName);
+		}
 	}
 
 	//Delete thread array
@@ -108,17 +302,55 @@ ThreadPool::~ThreadPool(void)
 		m_threads = NULL;
 	}
 
-	//Destroy conditional vars
-	for(uint32_t i = 0; i < (m_threadCount + m_maxQueueLength); i++)
+	//Drop the timers; one-shot tasks have been counted as pending already
+	for(std::unordered_map<ITask*, TimerWheel::Timer*>::iterator iter = m_timers.begin(); iter != m_timers.end(); iter++)
+	{
+		if(!iter->second->period)
+		{
+			iter->first->dispose();
+		}
+		delete iter->second;
+	}
+	m_timers.clear();
+
+	//Release the tasks that never got to run, whether they have been cancelled or not
+	ITask *task = NULL;
+	for(uint32_t i = 0; i < TASK_PRIORITY_COUNT; i++)
+	{
+		while(m_taskQueue[i]->tryDequeue(task))
+		{
+			task->dispose();
+		}
+		delete m_taskQueue[i];
+		m_taskQueue[i] = NULL;
+	}
+	for(size_t i = 0; i < m_nodeQueues.size(); i++)
+	{
+		while(m_nodeQueues[i]->tryDequeue(task))
+		{
+			task->dispose();
+		}
+		delete m_nodeQueues[i];
+	}
+	m_nodeQueues.clear();
+	for(uint32_t i = 0; i < m_slotCount; i++)
 	{
-		MTHREAD_COND_DESTROY(&m_condTaskDone[i]);
+		while(m_workers[i].deque.pop(task))
+		{
+			task->dispose();
+		}
 	}
 
-	//Delete conditional var array
-	if(m_condTaskDone)
+	//Delete worker array
+	if(m_workers)
 	{
-		delete [] m_condTaskDone;
-		m_condTaskDone = NULL;
+		for(uint32_t i = 0; i < m_slotCount; i++)
+		{
+			delete m_workers[i].events;
+			delete m_workers[i].trace;
+		}
+		delete [] m_workers;
+		m_workers = NULL;
 	}
 
 	//Destroy conditional var
@@ -127,14 +359,17 @@ ThreadPool::~ThreadPool(void)
 	//Destroy semaphores
 	MTHREAD_SEM_DESTROY(&m_semFree);
 	MTHREAD_SEM_DESTROY(&m_semUsed);
+	MTHREAD_SEM_DESTROY(&m_semDispatch);
+
+	//Nobody reads the listeners anymore
+	delete m_listenerSnapshot.exchange(NULL);
+	delete m_sharedTrace;
 
 	//Destroy the lock
 	MTHREAD_MUTEX_DESTROY(&m_lockTask);
 	MTHREAD_MUTEX_DESTROY(&m_lockListeners);
-
-	//Clear pending tasks
-	std::queue<MTHREADPOOL_NS::ITask*> empty;
-	m_taskQueue.swap(empty);
+	MTHREAD_MUTEX_DESTROY(&m_lockThreads);
+	MTHREAD_MUTEX_DESTROY(&m_lockTimers);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -142,25 +377,35 @@ ThreadPool::~ThreadPool(void)
 ///////////////////////////////////////////////////////////////////////////////
 
 bool ThreadPool::schedule(ITask *const task)
+{
+	return schedule(task, TASK_PRIORITY_NORMAL);
+}
+
+bool ThreadPool::trySchedule(ITask *const task)
+{
+	return trySchedule(task, TASK_PRIORITY_NORMAL);
+}
+
+bool ThreadPool::schedule(ITask *const task, const uint32_t &priority)
 {
 	try
 	{
-		MTHREAD_SEM_WAIT(&m_semFree);
-		MTHREAD_MUTEX_LOCK(&m_lockTask);
-
-		if(m_taskList.find(task) == m_taskList.end())
+		if(priority >= TASK_PRIORITY_COUNT)
 		{
-			m_taskList.insert(std::make_pair(task, &m_condTaskDone[m_nextCondIndex]));
-			m_nextCondIndex = (m_nextCondIndex + 1) % (m_threadCount + m_maxQueueLength);
-			m_taskQueue.push(task);
-			MTHREAD_SEM_POST(&m_semUsed);
+			LOG("Invalid task priority %u!", priority);
+			return false;
 		}
-		else
+
+		//Worker deques only hold tasks of normal priority
+		Worker *const worker = localWorker(this);
+		if(worker && (priority == TASK_PRIORITY_NORMAL))
 		{
-			LOG("Task %p has already been scheduled!", task);
+			enqueueLocal(worker, task);
+			return true;
 		}
 
-		MTHREAD_MUTEX_UNLOCK(&m_lockTask);
+		waitForSlot(this);
+		enqueueTask(this, task, priority, currentNode(this, currentWorker(this)));
 		return true;
 	}
 	catch(std::exception &e)
@@ -175,27 +420,27 @@ bool ThreadPool::schedule(ITask *const task)
 	}
 }
 
-bool ThreadPool::trySchedule(ITask *const task)
+bool ThreadPool::trySchedule(ITask *const task, const uint32_t &priority)
 {
 	try
 	{
-		if(MTHREAD_SEM_TRYWAIT(&m_semFree))
+		if(priority >= TASK_PRIORITY_COUNT)
 		{
-			MTHREAD_MUTEX_LOCK(&m_lockTask);
+			LOG("Invalid task priority %u!", priority);
+			return false;
+		}
 
-			if(m_taskList.find(task) == m_taskList.end())
-			{
-				m_taskList.insert(std::make_pair(task, &m_condTaskDone[m_nextCondIndex]));
-				m_nextCondIndex = (m_nextCondIndex + 1) % (m_threadCount + m_maxQueueLength);
-				m_taskQueue.push(task);
-				MTHREAD_SEM_POST(&m_semUsed);
-			}
-			else
-			{
-				LOG("Task %p has already been scheduled!", task);
-			}
+		//Worker deques only hold tasks of normal priority
+		Worker *const worker = localWorker(this);
+		if(worker && (priority == TASK_PRIORITY_NORMAL))
+		{
+			enqueueLocal(worker, task);
+			return true;
+		}
 
-			MTHREAD_MUTEX_UNLOCK(&m_lockTask);
+		if(MTHREAD_SEM_TRYWAIT(&m_semFree))
+		{
+			enqueueTask(this, task, priority, currentNode(this, currentWorker(this)));
 			return true;
 		}
 		else
@@ -217,21 +462,28 @@ bool ThreadPool::trySchedule(ITask *const task)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Wait for pending tasks
+// Schedule multiple tasks
 ///////////////////////////////////////////////////////////////////////////////
 
-bool ThreadPool::wait(void)
+bool ThreadPool::scheduleBatch(ITask *const *const tasks, const size_t &count)
 {
 	try
 	{
-		MTHREAD_MUTEX_LOCK(&m_lockTask);
+		if(Worker *const worker = localWorker(this))
+		{
+			enqueueLocalBatch(worker, tasks, count);
+			return true;
+		}
 
-		while((!m_taskQueue.empty()) || (m_runningTasks > 0))
+		const uint32_t node = currentNode(this, currentWorker(this));
+		size_t offset = 0;
+		while(offset < count)
 		{
-			MTHREAD_COND_WAIT(&m_condAllDone, &m_lockTask);
+			const uint32_t slots = acquireSlots(this, uint32_t(std::min(count - offset, size_t(BATCH_CHUNK_SIZE))), true);
+			enqueueBatch(this, tasks + offset, slots, node);
+			offset += slots;
 		}
 
-		MTHREAD_MUTEX_UNLOCK(&m_lockTask);
 		return true;
 	}
 	catch(std::exception &e)
@@ -246,21 +498,31 @@ bool ThreadPool::wait(void)
 	}
 }
 
-bool ThreadPool::wait(MTHREADPOOL_NS::ITask *const task)
+bool ThreadPool::tryScheduleBatch(ITask *const *const tasks, const size_t &count, size_t &scheduled)
 {
+	scheduled = 0;
+
 	try
 	{
-		MTHREAD_MUTEX_LOCK(&m_lockTask);
-		
-		std::unordered_map<ITask*,pthread_cond_t*>::iterator iter = m_taskList.find(task);
+		if(Worker *const worker = localWorker(this))
+		{
+			enqueueLocalBatch(worker, tasks, count);
+			scheduled = count;
+			return true;
+		}
 
-		while(iter != m_taskList.end())
+		const uint32_t node = currentNode(this, currentWorker(this));
+		while(scheduled < count)
 		{
-			MTHREAD_COND_WAIT(iter->second, &m_lockTask);
-			iter = m_taskList.find(task);
+			const uint32_t slots = acquireSlots(this, uint32_t(std::min(count - scheduled, size_t(BATCH_CHUNK_SIZE))), false);
+			if(slots < 1)
+			{
+				break; /*queue is full*/
+			}
+			enqueueBatch(this, tasks + scheduled, slots, node);
+			scheduled += slots;
 		}
 
-		MTHREAD_MUTEX_UNLOCK(&m_lockTask);
 		return true;
 	}
 	catch(std::exception &e)
@@ -276,25 +538,21 @@ bool ThreadPool::wait(MTHREADPOOL_NS::ITask *const task)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Add or remove listener
+// Schedule to NUMA node
 ///////////////////////////////////////////////////////////////////////////////
 
-bool ThreadPool::addListener(IListener *const listener)
+bool ThreadPool::scheduleOnNode(ITask *const task, const uint32_t &node)
 {
 	try
 	{
-		MTHREAD_MUTEX_LOCK(&m_lockListeners);
-
-		if(m_listeners.find(listener) == m_listeners.end())
-		{
-			m_listeners.insert(listener);
-		}
-		else
+		if(node >= getNodeCount())
 		{
-			LOG("Listener %p already registered!", listener);
+			LOG("Invalid NUMA node %u!", node);
+			return false;
 		}
 
-		MTHREAD_MUTEX_UNLOCK(&m_lockListeners);
+		waitForSlot(this);
+		enqueueTask(this, task, TASK_PRIORITY_NORMAL, m_nodeQueues.empty() ? NO_NODE : node);
 		return true;
 	}
 	catch(std::exception &e)
@@ -309,26 +567,58 @@ bool ThreadPool::addListener(IListener *const listener)
 	}
 }
 
-bool ThreadPool::removeListener(IListener *const listener)
+///////////////////////////////////////////////////////////////////////////////
+// Schedule task graph
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::scheduleGraph(ITaskGraph *const graph)
 {
 	try
 	{
-		MTHREAD_MUTEX_LOCK(&m_lockListeners);
-
-		std::set<IListener*>::iterator iter = m_listeners.find(listener);
+		return static_cast<TaskGraph*>(graph)->launch(this);
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
 
-		if(iter != m_listeners.end())
-		{
-			m_listeners.erase(iter);
-		}
-		else
+bool ThreadPool::scheduleContinuation(ITask *const task)
+{
+	try
+	{
+		if(Worker *const worker = currentWorker(this))
 		{
-			LOG("Listener %p not found!", listener);
+			enqueueLocal(worker, task);
+			return true;
 		}
 
-		MTHREAD_MUTEX_UNLOCK(&m_lockListeners);
+		waitForSlot(this);
+		enqueueTask(this, task, TASK_PRIORITY_NORMAL, currentNode(this, NULL));
 		return true;
 	}
+	catch(...)
+	{
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Schedule delayed or periodic tasks
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::scheduleAfter(ITask *const task, const uint32_t &delay)
+{
+	try
+	{
+		return addTimer(this, task, delay, 0);
+	}
 	catch(std::exception &e)
 	{
 		LOG("Exception error: %s", e.what());
@@ -341,116 +631,2046 @@ bool ThreadPool::removeListener(IListener *const listener)
 	}
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Thread entry point
-///////////////////////////////////////////////////////////////////////////////
-
-void *ThreadPool::entryPoint(void *arg)
+bool ThreadPool::scheduleEvery(ITask *const task, const uint32_t &period)
 {
 	try
 	{
-		processingLoop(static_cast<ThreadPool*>(arg));
+		if(period == 0)
+		{
+			LOG("Invalid timer period!");
+			return false;
+		}
+
+		return addTimer(this, task, period, period);
 	}
 	catch(std::exception &e)
 	{
-		LOG("Exception error in worker thread: %s", e.what());
+		LOG("Exception error: %s", e.what());
+		return false;
 	}
 	catch(...)
 	{
-		LOG("Unknown exception error in worker thread!");
+		LOG("Unknown exception error!");
+		return false;
 	}
-
-	return NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Processing loop
+// Cancel tasks
 ///////////////////////////////////////////////////////////////////////////////
 
-void ThreadPool::processingLoop(ThreadPool* pool)
+bool ThreadPool::cancel(ITask *const task)
 {
-	while(!pool->m_bStopFlag)
+	try
 	{
-		ITask *task = fetchNextTask(pool);
+		bool hadTimer = false, oneShot = false;
 
-		if(task)
+		//Stop the timer first, so that a periodic task does not become pending again behind our back
+		MTHREAD_MUTEX_LOCK(&m_lockTimers);
+
+		std::unordered_map<ITask*, TimerWheel::Timer*>::iterator iter = m_timers.find(task);
+		if(iter != m_timers.end())
 		{
-			notifyListeners(pool, task, false);
+			TimerWheel::Timer *const timer = iter->second;
+			m_timerWheel.remove(timer);
+			m_timers.erase(iter);
+			m_nextTimer.store(m_timerWheel.nextExpiry());
+			hadTimer = true;
+			oneShot = (timer->period == 0);
+			delete timer;
+		}
 
-			try
-			{
-				task->run();
-			}
-			catch(...)
-			{
-				LOG("Task %p encountered an internal error!", task);
-			}
+		MTHREAD_MUTEX_UNLOCK(&m_lockTimers);
 
-			notifyListeners(pool, task, true);
-			finalizeTask(pool, task);
+		//A one-shot task that is still waiting for its timer has never been queued, so nobody else can see it
+		if(oneShot)
+		{
+			countersOf(this, currentWorker(this))->cancelled.fetch_add(1, std::memory_order_relaxed);
+			finalizeTask(this, task);
+			return true;
 		}
-	}
-}
-
-ITask *ThreadPool::fetchNextTask(MTHREADPOOL_NS::ThreadPool* pool)
-{
-	ITask *task = NULL;
 
-	MTHREAD_SEM_WAIT(&pool->m_semUsed);
-	MTHREAD_MUTEX_LOCK(&pool->m_lockTask);
+		//The queue entry stays where it is, the thread that dequeues it drops the task; a running task is not interrupted,
+		//the flag is what it sees in isCancelled()
+		uint32_t state = task->m_state.load();
+		do
+		{
+			if((!(state & TASK_STATE_PENDING)) || (state & TASK_STATE_CANCELLED))
+			{
+				return hadTimer;
+			}
+		}
+		while(!task->m_state.compare_exchange_weak(state, state | TASK_STATE_CANCELLED));
 
-	if(!(pool->m_taskQueue.empty() || pool->m_bStopFlag))
+		return true;
+	}
+	catch(std::exception &e)
 	{
-		task = pool->m_taskQueue.front();
-		pool->m_taskQueue.pop();
-		MTHREAD_SEM_POST(&pool->m_semFree);
+		LOG("Exception error: %s", e.what());
+		return false;
 	}
-
-	if(task)
+	catch(...)
 	{
-		pool->m_runningTasks++;
+		LOG("Unknown exception error!");
+		return false;
 	}
-
-	MTHREAD_MUTEX_UNLOCK(&pool->m_lockTask);
-	return task;
 }
 
-void ThreadPool::finalizeTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task)
+bool ITask::isCancelled(void) const
 {
-	MTHREAD_MUTEX_LOCK(&pool->m_lockTask);
-
-	pool->m_runningTasks--;
-	std::unordered_map<ITask*,pthread_cond_t*>::iterator iter = pool->m_taskList.find(task);
-
-	if(iter != pool->m_taskList.end())
-	{
-		MTHREAD_COND_BROADCAST(iter->second);
-		pool->m_taskList.erase(iter);
-	}
-
-	if(pool->m_runningTasks == 0)
-	{
-		MTHREAD_COND_BROADCAST(&pool->m_condAllDone);
-	}
-
-	MTHREAD_MUTEX_UNLOCK(&pool->m_lockTask);
+	return (m_state.load(std::memory_order_relaxed) & TASK_STATE_CANCELLED) != 0;
 }
 
-void ThreadPool::notifyListeners(ThreadPool* pool, ITask* task, const bool &finished)
-{
-	MTHREAD_MUTEX_LOCK(&pool->m_lockListeners);
+///////////////////////////////////////////////////////////////////////////////
+// Wait for pending tasks
+///////////////////////////////////////////////////////////////////////////////
 
-	for(std::set<IListener*>::iterator iter = pool->m_listeners.begin(); iter != pool->m_listeners.end(); iter++)
+bool ThreadPool::wait(void)
+{
+	try
 	{
-		if(finished)
+		if(currentWorker(this))
 		{
-			(*iter)->taskFinished(task);
+			LOG("Cannot wait for all tasks from within a worker thread!");
+			return false;
+		}
+
+		if(cooperativeWait(this))
+		{
+			helpWhile(this, [this]() { return m_pendingTasks.load() > 0; });
+		}
+
+		MTHREAD_MUTEX_LOCK(&m_lockTask);
+
+		while(m_pendingTasks.load() > 0)
+		{
+			MTHREAD_COND_WAIT(&m_condAllDone, &m_lockTask);
+		}
+
+		MTHREAD_MUTEX_UNLOCK(&m_lockTask);
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+bool ThreadPool::wait(MTHREADPOOL_NS::ITask *const task)
+{
+	try
+	{
+		if(cooperativeWait(this))
+		{
+			helpWhile(this, [task]() { return (task->m_state.load() & TASK_STATE_PENDING) != 0; });
+		}
+
+		//A worker that blocks here holds up the queues and the timers, so somebody has to take over
+		const bool blocking = ((task->m_state.load() & TASK_STATE_PENDING) != 0) && enterBlocking();
+		ParkingLot::waitWhile(&task->m_state, TASK_STATE_PENDING, TASK_STATE_WAITERS, WAIT_SPIN_COUNT);
+		if(blocking)
+		{
+			leaveBlocking();
+		}
+
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+bool ThreadPool::wait(MTHREADPOOL_NS::ITaskGraph *const graph)
+{
+	try
+	{
+		TaskGraph *const taskGraph = static_cast<TaskGraph*>(graph);
+
+		if(cooperativeWait(this))
+		{
+			helpWhile(this, [taskGraph]() { return taskGraph->isRunning(); });
+		}
+
+		const bool blocking = taskGraph->isRunning() && enterBlocking();
+		taskGraph->wait();
+		if(blocking)
+		{
+			leaveBlocking();
+		}
+
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Help with pending tasks
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::runPending(void)
+{
+	try
+	{
+		Worker *const worker = currentWorker(this);
+		if(ITask *const task = tryFetchTask(this, worker))
+		{
+			executeTask(this, worker, task);
+			return true;
+		}
+
+		return false;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+bool ThreadPool::runPendingWhile(const std::atomic<uint32_t> &counter)
+{
+	try
+	{
+		//Every decrement is followed by the end of a task, which wakes us up if we had to park
+		helpWhile(this, [&counter]() { return counter.load() > 0; });
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Blocking regions
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::enterBlocking(void)
+{
+	try
+	{
+		Worker *const worker = currentWorker(this);
+		if(!worker)
+		{
+			return false; /*not one of our workers, so the pool is not affected*/
+		}
+
+		if(worker->blockDepth++ > 0)
+		{
+			return true;
+		}
+
+		m_blockedThreads++;
+		worker->compensated = false;
+
+		//Keep a worker that was about to retire after an earlier region, or start a spare one
+		MTHREAD_MUTEX_LOCK(&m_lockThreads);
+
+		uint32_t surplus = m_surplusThreads.load();
+		while((surplus > 0) && (!worker->compensated))
+		{
+			worker->compensated = m_surplusThreads.compare_exchange_weak(surplus, surplus - 1);
+		}
+
+		if((!worker->compensated) && (!m_bStopFlag))
+		{
+			worker->compensated = spawnWorker(this);
+		}
+
+		MTHREAD_MUTEX_UNLOCK(&m_lockThreads);
+
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return true;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return true;
+	}
+}
+
+bool ThreadPool::leaveBlocking(void)
+{
+	try
+	{
+		Worker *const worker = currentWorker(this);
+		if((!worker) || (worker->blockDepth < 1))
+		{
+			LOG("Not inside of a blocking region!");
+			return false;
+		}
+
+		if(--worker->blockDepth > 0)
+		{
+			return true;
+		}
+
+		m_blockedThreads--;
+
+		//One worker is surplus now; wake somebody up, in case that they are all idle, so that it can retire
+		if(worker->compensated)
+		{
+			worker->compensated = false;
+			m_surplusThreads++;
+			MTHREAD_SEM_POST(&m_semUsed);
+		}
+
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+uint32_t ThreadPool::getThreadCount(void) const
+{
+	return m_activeThreads.load();
+}
+
+uint32_t ThreadPool::getNodeCount(void) const
+{
+	return std::max<uint32_t>(uint32_t(m_nodeQueues.size()), 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Statistics
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::getStats(PoolStats &stats) const
+{
+	try
+	{
+		stats.tasksScheduled = stats.tasksCompleted = stats.tasksFailed = stats.tasksCancelled = stats.tasksStolen = 0;
+		stats.scheduleBlockedTime = 0;
+		stats.queueDepth = stats.runningTasks = 0;
+		stats.workers.resize(m_slotCount);
+
+		//Threads outside of the pool share one set of counters
+		addCounters(stats, m_sharedCounters);
+
+		for(uint32_t i = 0; i < m_slotCount; i++)
+		{
+			const Worker &worker = m_workers[i];
+			WorkerStats &workerStats = stats.workers[i];
+			addCounters(stats, worker.counters);
+
+			workerStats.alive = (worker.status.load(std::memory_order_relaxed) == WORKER_RUNNING);
+			workerStats.running = (worker.counters.running.load(std::memory_order_relaxed) > 0);
+			workerStats.tasksCompleted = worker.counters.completed.load(std::memory_order_relaxed);
+			workerStats.tasksFailed = worker.counters.failed.load(std::memory_order_relaxed);
+			workerStats.tasksStolen = worker.counters.stolen.load(std::memory_order_relaxed);
+			workerStats.busyTime = worker.counters.busyTime.load(std::memory_order_relaxed) / 1000;
+			workerStats.idleTime = worker.counters.idleTime.load(std::memory_order_relaxed) / 1000;
+
+			stats.queueDepth += uint32_t(worker.deque.size());
+		}
+
+		for(uint32_t i = 0; i < TASK_PRIORITY_COUNT; i++)
+		{
+			stats.queueDepth += uint32_t(m_taskQueue[i]->size());
+		}
+
+		for(size_t i = 0; i < m_nodeQueues.size(); i++)
+		{
+			stats.queueDepth += uint32_t(m_nodeQueues[i]->size());
+		}
+
+		stats.pendingTasks = m_pendingTasks.load();
+		stats.threadCount = m_activeThreads.load();
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+bool ThreadPool::getLatency(const uint32_t &kind, LatencyStats &stats) const
+{
+	try
+	{
+		if(kind >= LATENCY_KIND_COUNT)
+		{
+			LOG("Invalid latency kind %u!", kind);
+			return false;
+		}
+
+		//Each worker only ever writes to its own histogram, they are merged here
+		std::vector<uint64_t> counts(LatencyHistogram::BUCKET_COUNT, 0);
+		uint64_t sum = 0;
+
+		m_sharedLatency[kind].mergeInto(counts, sum);
+		for(uint32_t i = 0; i < m_slotCount; i++)
+		{
+			m_workers[i].latency[kind].mergeInto(counts, sum);
+		}
+
+		stats.count = 0;
+		stats.min = stats.max = 0;
+		for(uint32_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+		{
+			if(counts[i] > 0)
+			{
+				stats.min = stats.count ? stats.min : LatencyHistogram::lowestValue(i);
+				stats.max = LatencyHistogram::highestValue(i);
+				stats.count += counts[i];
+			}
+		}
+
+		stats.mean = stats.count ? (sum / stats.count) : 0;
+		stats.p50 = valueAt(counts, stats.count, 0.5);
+		stats.p90 = valueAt(counts, stats.count, 0.9);
+		stats.p99 = valueAt(counts, stats.count, 0.99);
+		stats.p999 = valueAt(counts, stats.count, 0.999);
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tracing
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::dumpTrace(const char *const fileName) const
+{
+	try
+	{
+		if(!m_sharedTrace)
+		{
+			LOG("Tracing is not enabled for this pool!");
+			return false;
+		}
+
+		FILE *const file = fopen(fileName, "w");
+		if(!file)
+		{
+			LOG("Failed to open trace file \"%s\"!", fileName);
+			return false;
+		}
+
+		fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+		fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MThreadPool %p\"}}", static_cast<const void*>(this));
+
+		std::vector<TraceEvent> events;
+		for(uint32_t i = 0; i <= m_slotCount; i++)
+		{
+			events.clear();
+			if(i < m_slotCount)
+			{
+				m_workers[i].trace->copyTo(events);
+				fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Worker #%u\"}}", i + 1, i);
+			}
+			else
+			{
+				m_sharedTrace->copyTo(events);
+			}
+
+			//Timestamps are in microseconds; flow events connect the point where a task was queued with the point where it started
+			for(std::vector<TraceEvent>::const_iterator iter = events.begin(); iter != events.end(); iter++)
+			{
+				const double ts = double(iter->time - m_traceBase) / 1000.0, dur = double(iter->duration) / 1000.0;
+				switch(iter->type)
+				{
+				case TRACE_QUEUED:
+					fprintf(file, ",\n{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"task\":\"%p\"}}", ts, iter->thread, iter->task);
+					fprintf(file, ",\n{\"name\":\"task\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":\"%p\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", iter->task, ts, iter->thread);
+					break;
+				case TRACE_RUN:
+					fprintf(file, ",\n{\"name\":\"run\",\"cat\":\"task\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"task\":\"%p\"}}", ts, dur, iter->thread, iter->task);
+					fprintf(file, ",\n{\"name\":\"task\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"%p\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", iter->task, ts, iter->thread);
+					break;
+				case TRACE_IDLE:
+					fprintf(file, ",\n{\"name\":\"idle\",\"cat\":\"worker\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", ts, dur, iter->thread);
+					break;
+				case TRACE_STEAL:
+					fprintf(file, ",\n{\"name\":\"steal\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"task\":\"%p\",\"victim\":%u}}", ts, iter->thread, iter->task, uint32_t(iter->arg));
+					break;
+				}
+			}
+		}
+
+		fprintf(file, "\n]}\n");
+		const bool success = (ferror(file) == 0);
+		fclose(file);
+
+		if(!success)
+		{
+			LOG("Failed to write trace file \"%s\"!", fileName);
+		}
+
+		return success;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add or remove listener
+///////////////////////////////////////////////////////////////////////////////
+
+bool ThreadPool::addListener(IListener *const listener)
+{
+	try
+	{
+		MTHREAD_MUTEX_LOCK(&m_lockListeners);
+
+		if(m_listeners.find(listener) == m_listeners.end())
+		{
+			m_listeners.insert(listener);
+			publishListeners(this);
+		}
+		else
+		{
+			LOG("Listener %p already registered!", listener);
+		}
+
+		MTHREAD_MUTEX_UNLOCK(&m_lockListeners);
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+bool ThreadPool::removeListener(IListener *const listener)
+{
+	try
+	{
+		MTHREAD_MUTEX_LOCK(&m_lockListeners);
+
+		std::set<IListener*>::iterator iter = m_listeners.find(listener);
+
+		if(iter != m_listeners.end())
+		{
+			m_listeners.erase(iter);
+			publishListeners(this);
+		}
+		else
+		{
+			LOG("Listener %p not found!", listener);
+		}
+
+		MTHREAD_MUTEX_UNLOCK(&m_lockListeners);
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error: %s", e.what());
+		return false;
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error!");
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Task memory
+///////////////////////////////////////////////////////////////////////////////
+
+void *ThreadPool::allocateTaskMemory(const size_t &size)
+{
+	try
+	{
+		Worker *const worker = currentWorker(this);
+		return m_taskAllocator.allocate(size, worker ? &worker->freeList : NULL);
+	}
+	catch(...)
+	{
+		LOG("Failed to allocate task memory!");
+		return NULL;
+	}
+}
+
+void ThreadPool::releaseTaskMemory(void *const memory, const size_t &size)
+{
+	Worker *const worker = currentWorker(this);
+	m_taskAllocator.release(memory, size, worker ? &worker->freeList : NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Thread entry point
+///////////////////////////////////////////////////////////////////////////////
+
+void *ThreadPool::entryPoint(void *arg)
+{
+	try
+	{
+		processingLoop(static_cast<Worker*>(arg));
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error in worker thread: %s", e.what());
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error in worker thread!");
+	}
+
+	return NULL;
+}
+
+void *ThreadPool::dispatchEntryPoint(void *arg)
+{
+	try
+	{
+		dispatchLoop(static_cast<ThreadPool*>(arg));
+	}
+	catch(std::exception &e)
+	{
+		LOG("Exception error in dispatcher thread: %s", e.what());
+	}
+	catch(...)
+	{
+		LOG("Unknown exception error in dispatcher thread!");
+	}
+
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Processing loop
+///////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::processingLoop(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	MTHREAD_SETSPECIFIC(g_workerKey, worker);
+
+	//Workers beyond the number of processors wrap around; failure to pin is not fatal
+	if(!pool->m_cpuOrder.empty())
+	{
+		setThreadAffinity(pool->m_cpuOrder[worker->index % pool->m_cpuOrder.size()]);
+	}
+	else if(!pool->m_nodeQueues.empty())
+	{
+		setThreadAffinity(pool->m_nodeCpus[worker->node]);
+	}
+
+	//Now that we run on our node, the deque is moved to local memory; this is done only once per slot
+	if((!pool->m_nodeQueues.empty()) && (!worker->relocated))
+	{
+		worker->deque.relocate();
+		worker->relocated = true;
+	}
+
+	while((!pool->m_bStopFlag) && (worker->status.load(std::memory_order_relaxed) != WORKER_RETIRED))
+	{
+		//Whoever comes along first with an empty deque retires, once a blocking region has ended
+		if((pool->m_surplusThreads.load(std::memory_order_relaxed) > 0) && worker->deque.empty() && retireSurplus(worker))
+		{
+			break;
+		}
+
+		if(pool->m_nextTimer.load(std::memory_order_relaxed) != TimerWheel::NO_EXPIRY)
+		{
+			processTimers(worker);
+		}
+
+		if(ITask *const task = fetchNextTask(worker))
+		{
+			executeTask(pool, worker, task);
+		}
+	}
+}
+
+void ThreadPool::executeTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, ITask* task)
+{
+	if(!claimTask(pool, worker, task))
+	{
+		return; /*task has been cancelled*/
+	}
+
+	notifyListeners(pool, worker, task, false);
+
+	//One time stamp serves the queue-wait histogram, the decision to grow the pool and the run time
+	const uint64_t startTime = MTHREAD_TIME_NS();
+	const uint32_t queueWait = static_cast<uint32_t>(startTime / 1000) - task->m_queued;
+	LatencyHistogram *const latency = worker ? worker->latency : pool->m_sharedLatency;
+	latency[LATENCY_QUEUE_WAIT].record(uint64_t(queueWait) * 1000);
+
+	if(isElastic(pool))
+	{
+		growPool(pool, queueWait);
+	}
+
+	//A task that helps out while waiting runs nested tasks; only the outermost one counts towards the busy time
+	Counters *const counters = countersOf(pool, worker);
+	const bool outermost = (counters->running.fetch_add(1, std::memory_order_relaxed) == 0) || (!worker);
+	bool failed = false;
+
+	try
+	{
+		task->run();
+	}
+	catch(...)
+	{
+		LOG("Task %p encountered an internal error!", task);
+		failed = true;
+	}
+
+	const uint64_t runTime = MTHREAD_TIME_NS() - startTime;
+	latency[LATENCY_RUN_TIME].record(runTime);
+	TRACE_EVENT(pool, worker, TRACE_RUN, task, startTime, runTime, 0);
+
+	if(outermost)
+	{
+		counters->busyTime.fetch_add(runTime, std::memory_order_relaxed);
+	}
+	(failed ? counters->failed : counters->completed).fetch_add(1, std::memory_order_relaxed);
+	counters->running.fetch_sub(1, std::memory_order_relaxed);
+
+	notifyListeners(pool, worker, task, true);
+	finalizeTask(pool, task);
+}
+
+ThreadPool::Worker *ThreadPool::currentWorker(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	Worker *const worker = static_cast<Worker*>(MTHREAD_GETSPECIFIC(g_workerKey));
+	return (worker && (worker->pool == pool)) ? worker : NULL;
+}
+
+ThreadPool::Worker *ThreadPool::localWorker(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	return (pool->m_flags & POOL_FLAG_WORK_STEALING) ? currentWorker(pool) : NULL;
+}
+
+ThreadPool::Counters *ThreadPool::countersOf(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker)
+{
+	return worker ? &worker->counters : &pool->m_sharedCounters;
+}
+
+void ThreadPool::resetCounters(Counters &counters)
+{
+	counters.scheduled = 0;
+	counters.completed = 0;
+	counters.failed = 0;
+	counters.cancelled = 0;
+	counters.stolen = 0;
+	counters.busyTime = 0;
+	counters.idleTime = 0;
+	counters.blockedTime = 0;
+	counters.running = 0;
+}
+
+void ThreadPool::addCounters(MTHREADPOOL_NS::PoolStats &stats, const Counters &counters)
+{
+	stats.tasksScheduled += counters.scheduled.load(std::memory_order_relaxed);
+	stats.tasksCompleted += counters.completed.load(std::memory_order_relaxed);
+	stats.tasksFailed += counters.failed.load(std::memory_order_relaxed);
+	stats.tasksCancelled += counters.cancelled.load(std::memory_order_relaxed);
+	stats.tasksStolen += counters.stolen.load(std::memory_order_relaxed);
+	stats.scheduleBlockedTime += counters.blockedTime.load(std::memory_order_relaxed) / 1000;
+	stats.runningTasks += counters.running.load(std::memory_order_relaxed);
+}
+
+uint64_t ThreadPool::valueAt(const std::vector<uint64_t> &counts, const uint64_t &total, const double &fraction)
+{
+	//Like HdrHistogram, we report the highest value that is equivalent to the one at the requested rank
+	const uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>((fraction * total) + 0.5), 1);
+	uint64_t seen = 0;
+
+	for(uint32_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+	{
+		seen += counts[i];
+		if(seen >= rank)
+		{
+			return LatencyHistogram::highestValue(i);
+		}
+	}
+
+	return 0;
+}
+
+bool ThreadPool::registerTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const bool &quiet)
+{
+	const uint32_t owned = task->m_state.load() & ITask::STATE_OWNED;
+	uint32_t state = owned;
+
+	if(!task->m_state.compare_exchange_strong(state, owned | TASK_STATE_PENDING))
+	{
+		if(!quiet)
+		{
+			LOG("Task %p has already been scheduled!", task);
+		}
+		return false;
+	}
+
+	const uint64_t now = MTHREAD_TIME_NS();
+	task->m_queued = static_cast<uint32_t>(now / 1000);
+	pool->m_pendingTasks++;
+
+	Worker *const worker = currentWorker(pool);
+	countersOf(pool, worker)->scheduled.fetch_add(1, std::memory_order_relaxed);
+	TRACE_EVENT(pool, worker, TRACE_QUEUED, task, now, 0, 0);
+	return true;
+}
+
+void ThreadPool::setupNodes(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	std::vector<cpu_info_t> topology;
+	if(!getProcessorTopology(topology))
+	{
+		LOG("Failed to determine NUMA nodes, falling back to a single queue!");
+		return;
+	}
+
+	//Node numbers may have gaps, so they are renumbered in ascending order
+	std::map<uint32_t, uint32_t> nodeIndex;
+	uint32_t maxCpu = 0;
+	for(size_t i = 0; i < topology.size(); i++)
+	{
+		nodeIndex[topology[i].node] = 0;
+		maxCpu = std::max(maxCpu, topology[i].cpu);
+	}
+
+	uint32_t nodeCount = 0;
+	for(std::map<uint32_t, uint32_t>::iterator iter = nodeIndex.begin(); iter != nodeIndex.end(); iter++)
+	{
+		iter->second = nodeCount++;
+	}
+
+	pool->m_nodeCpus.resize(nodeCount);
+	pool->m_cpuNode.assign(maxCpu + 1, NO_NODE);
+	for(size_t i = 0; i < topology.size(); i++)
+	{
+		const uint32_t node = nodeIndex[topology[i].node];
+		pool->m_nodeCpus[node].push_back(topology[i].cpu);
+		pool->m_cpuNode[topology[i].cpu] = node;
+	}
+
+	//Each queue is created while we are running on its node, so that the memory is local to it (first touch)
+	std::vector<uint32_t> affinity;
+	const bool restore = getThreadAffinity(affinity);
+
+	for(uint32_t i = 0; i < nodeCount; i++)
+	{
+		setThreadAffinity(pool->m_nodeCpus[i]);
+		pool->m_nodeQueues.push_back(new BoundedQueue<ITask*>(pool->m_maxQueueLength));
+	}
+
+	if(restore)
+	{
+		setThreadAffinity(affinity);
+	}
+}
+
+uint32_t ThreadPool::currentNode(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker)
+{
+	if(pool->m_nodeQueues.empty())
+	{
+		return NO_NODE;
+	}
+
+	if(worker)
+	{
+		return worker->node;
+	}
+
+	uint32_t cpu = 0;
+	return (getCurrentProcessor(cpu) && (cpu < pool->m_cpuNode.size())) ? pool->m_cpuNode[cpu] : NO_NODE;
+}
+
+void ThreadPool::enqueueTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const uint32_t &priority, const uint32_t &node)
+{
+	if(!registerTask(pool, task))
+	{
+		MTHREAD_SEM_POST(&pool->m_semFree);
+		return;
+	}
+
+	//Tasks of normal priority go to the queue of the node, if any; all queues share the same free slots
+	BoundedQueue<ITask*> *const queue = ((priority == TASK_PRIORITY_NORMAL) && (node < pool->m_nodeQueues.size())) ? pool->m_nodeQueues[node] : pool->m_taskQueue[priority];
+
+	//The free-slot semaphore guarantees that there is room in the queue, but a consumer may still be reading the cell
+	while(!queue->tryEnqueue(task))
+	{
+		MTHREAD_YIELD();
+	}
+
+	signalTasks(pool, 1);
+}
+
+uint64_t ThreadPool::currentTime(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	return MTHREAD_TIME_MS() - pool->m_timeBase;
+}
+
+bool ThreadPool::addTimer(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const uint32_t &delay, const uint32_t &period)
+{
+	TimerWheel::Timer *const timer = new TimerWheel::Timer();
+	timer->task = task;
+	timer->period = period;
+
+	MTHREAD_MUTEX_LOCK(&pool->m_lockTimers);
+
+	if(pool->m_timers.find(task) != pool->m_timers.end())
+	{
+		MTHREAD_MUTEX_UNLOCK(&pool->m_lockTimers);
+		LOG("Task %p already has a timer!", task);
+		delete timer;
+		return false;
+	}
+
+	//A one-shot task is pending from now on, whereas a periodic task becomes pending each time it fires
+	if((!period) && (!registerTask(pool, task)))
+	{
+		MTHREAD_MUTEX_UNLOCK(&pool->m_lockTimers);
+		delete timer;
+		return false;
+	}
+
+	const uint64_t now = currentTime(pool);
+	timer->expiry = now + delay;
+	pool->m_timers[task] = timer;
+	pool->m_timerWheel.insert(timer, now);
+
+	const bool earliest = (timer->expiry < pool->m_nextTimer.load());
+	if(earliest)
+	{
+		pool->m_nextTimer.store(timer->expiry);
+	}
+
+	MTHREAD_MUTEX_UNLOCK(&pool->m_lockTimers);
+
+	//The worker that keeps an eye on the timers may be sleeping for too long now, so get somebody to take over
+	if(earliest)
+	{
+		pool->m_timerRearm.store(true);
+		MTHREAD_SEM_POST(&pool->m_semUsed);
+	}
+
+	return true;
+}
+
+void ThreadPool::processTimers(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	const uint64_t now = currentTime(pool);
+
+	//Whoever gets the lock advances the wheel; everybody else just carries on
+	if((now < pool->m_nextTimer.load()) || (!MTHREAD_MUTEX_TRYLOCK(&pool->m_lockTimers)))
+	{
+		return;
+	}
+
+	pool->m_expiredTimers.clear();
+	pool->m_timerWheel.advance(now, pool->m_expiredTimers);
+
+	uint32_t readyCount = 0;
+	for(std::vector<TimerWheel::Timer*>::const_iterator iter = pool->m_expiredTimers.begin(); iter != pool->m_expiredTimers.end(); iter++)
+	{
+		TimerWheel::Timer *const timer = *iter;
+		ITask *const task = timer->task;
+
+		if(timer->period)
+		{
+			//Periodic timers keep their phase, but runs that have been missed entirely are not made up for
+			timer->expiry += timer->period;
+			if(timer->expiry <= now)
+			{
+				timer->expiry = now + timer->period;
+			}
+			pool->m_timerWheel.insert(timer, now);
+
+			if(!registerTask(pool, task, true))
+			{
+				continue; /*previous run is still pending*/
+			}
+		}
+		else
+		{
+			pool->m_timers.erase(task);
+			delete timer;
+		}
+
+		task->m_queued = static_cast<uint32_t>(MTHREAD_TIME_US());
+		worker->deque.push(task);
+		readyCount++;
+	}
+
+	pool->m_nextTimer.store(pool->m_timerWheel.nextExpiry());
+	MTHREAD_MUTEX_UNLOCK(&pool->m_lockTimers);
+
+	//The expired tasks have been moved to our own deque in one go, idle workers will steal them from there
+	signalTasks(pool, readyCount);
+}
+
+bool ThreadPool::parkWorker(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+
+	//While there are timers, one of the idle workers sleeps with a timeout, so that they fire without an extra thread
+	const uint64_t nextTimer = pool->m_nextTimer.load();
+	if(nextTimer != TimerWheel::NO_EXPIRY)
+	{
+		bool keeper = false;
+		if(pool->m_timerRearm.exchange(false) || pool->m_timerKeeper.compare_exchange_strong(keeper, true))
+		{
+			pool->m_timerKeeper.store(true);
+			const uint64_t now = currentTime(pool);
+			if(!enterIdle(pool))
+			{
+				pool->m_timerKeeper.store(false);
+				return true;
+			}
+			const bool signalled = (nextTimer > now) && MTHREAD_SEM_TIMEDWAIT(&pool->m_semUsed, static_cast<uint32_t>(std::min<uint64_t>(nextTimer - now, UINT32_MAX)));
+			pool->m_idleThreads--;
+			pool->m_timerKeeper.store(false);
+			return signalled;
+		}
+	}
+
+	if(!enterIdle(pool))
+	{
+		return true;
+	}
+
+	//In an elastic pool, a worker that has been idle for the whole keep-alive period goes away
+	if(isElastic(pool))
+	{
+		const bool signalled = MTHREAD_SEM_TIMEDWAIT(&pool->m_semUsed, pool->m_keepAlive);
+		pool->m_idleThreads--;
+		if(!signalled)
+		{
+			retireWorker(worker);
+		}
+		return signalled;
+	}
+
+	MTHREAD_SEM_WAIT(&pool->m_semUsed);
+	pool->m_idleThreads--;
+	return true;
+}
+
+bool ThreadPool::enterIdle(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	//Pushes to a deque only post a signal when they see an idle worker, so a task that arrived just before we got counted must be stolen now
+	pool->m_idleThreads++;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if(dequesEmpty(pool))
+	{
+		return true;
+	}
+
+	pool->m_idleThreads--;
+	return false;
+}
+
+bool ThreadPool::isElastic(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	return pool->m_threadCount > pool->m_minThreads;
+}
+
+bool ThreadPool::spawnWorker(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	for(uint32_t i = 0; i < pool->m_slotCount; i++)
+	{
+		Worker *const worker = &pool->m_workers[i];
+		const uint32_t status = worker->status.load();
+		if(status == WORKER_RUNNING)
+		{
+			continue;
+		}
+
+		//The slot of a retired worker can be re-used as soon as its thread has exited
+		if(status == WORKER_RETIRED)
+		{
+			MTHREAD_JOIN(pool->m_threads[i]);
+		}
+
+		worker->status.store(WORKER_RUNNING);
+		pool->m_activeThreads++;
+
+		try
+		{
+			MTHREAD_CREATE(&pool->m_threads[i], NULL, entryPoint, worker);
+		}
+		catch(...)
+		{
+			pool->m_activeThreads--;
+			worker->status.store(WORKER_STOPPED);
+			throw;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::growPool(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &queueWait)
+{
+	//The time the task has spent in the queue tells us whether the workers are keeping up
+	if(queueWait < (pool->m_spawnLatency * 1000))
+	{
+		return;
+	}
+
+	const uint32_t now = static_cast<uint32_t>(currentTime(pool));
+
+	//Idle or spinning workers are about to pick up the work anyway, and one new worker per interval is enough
+	if((pool->m_activeThreads.load() >= (growthLimit(pool, now) + pool->m_blockedThreads.load())) || (pool->m_idleThreads.load() > 0) || (pool->m_spinning.load() > 0) || ((now - pool->m_lastSpawn.load()) < pool->m_spawnLatency))
+	{
+		return;
+	}
+
+	if(!MTHREAD_MUTEX_TRYLOCK(&pool->m_lockThreads))
+	{
+		return;
+	}
+
+	try
+	{
+		if((!pool->m_bStopFlag) && (pool->m_activeThreads.load() < (growthLimit(pool, now) + pool->m_blockedThreads.load())))
+		{
+			spawnWorker(pool);
+			pool->m_lastSpawn.store(now);
+		}
+	}
+	catch(...)
+	{
+		LOG("Failed to spawn an additional worker!");
+	}
+
+	MTHREAD_MUTEX_UNLOCK(&pool->m_lockThreads);
+}
+
+uint32_t ThreadPool::growthLimit(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &now)
+{
+	//The CPU quota of a container can change at runtime, so re-read it once in a while; only one thread gets to do so
+	uint32_t checked = pool->m_quotaChecked.load();
+	if(((now - checked) >= QUOTA_RECHECK) && pool->m_quotaChecked.compare_exchange_strong(checked, now))
+	{
+		pool->m_cpuQuota.store(getProcessorQuota());
+	}
+
+	//Threads beyond the quota would only be throttled, but the minimum is always granted; surplus workers retire after the keep-alive
+	const uint32_t quota = pool->m_cpuQuota.load();
+	return quota ? std::max(pool->m_minThreads, std::min(pool->m_threadCount, quota)) : pool->m_threadCount;
+}
+
+bool ThreadPool::retireWorker(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	uint32_t active = pool->m_activeThreads.load();
+
+	//Never drop below the minimum; the thread is joined later, either by the next spawn that re-uses the slot or by the destructor
+	while(active > pool->m_minThreads)
+	{
+		if(pool->m_activeThreads.compare_exchange_weak(active, active - 1))
+		{
+			worker->status.store(WORKER_RETIRED);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::retireSurplus(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	uint32_t surplus = pool->m_surplusThreads.load();
+
+	while(surplus > 0)
+	{
+		if(pool->m_surplusThreads.compare_exchange_weak(surplus, surplus - 1))
+		{
+			pool->m_activeThreads--;
+			worker->status.store(WORKER_RETIRED);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::signalTasks(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count)
+{
+	//Spinning workers will pick up the new tasks anyway, so we can skip the system call for as many of them
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const uint32_t spinning = pool->m_spinning.load(std::memory_order_relaxed);
+
+	if(count > spinning)
+	{
+		MTHREAD_SEM_POST(&pool->m_semUsed, count - spinning);
+	}
+
+	wakeHelpers(pool);
+}
+
+void ThreadPool::signalThieves(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count)
+{
+	//The owner of the deque runs the tasks anyway, so a signal is only needed to wake up a parked worker that can steal them;
+	//signals that nobody waits for would pile up and make every idle worker spin through them later on
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const uint32_t wakeCount = std::min(count, pool->m_idleThreads.load(std::memory_order_relaxed));
+	const uint32_t spinning = pool->m_spinning.load(std::memory_order_relaxed);
+
+	if(wakeCount > spinning)
+	{
+		MTHREAD_SEM_POST(&pool->m_semUsed, wakeCount - spinning);
+	}
+
+	wakeHelpers(pool);
+}
+
+void ThreadPool::enqueueLocal(Worker *const worker, ITask* task)
+{
+	if(registerTask(worker->pool, task))
+	{
+		worker->deque.push(task);
+		signalThieves(worker->pool, 1);
+	}
+}
+
+uint32_t ThreadPool::acquireSlots(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count, const bool &blocking)
+{
+	uint32_t acquired = 0;
+
+	if(blocking && (count > 0))
+	{
+		waitForSlot(pool);
+		acquired++;
+	}
+
+	while((acquired < count) && MTHREAD_SEM_TRYWAIT(&pool->m_semFree))
+	{
+		acquired++;
+	}
+
+	return acquired;
+}
+
+void ThreadPool::enqueueBatch(MTHREADPOOL_NS::ThreadPool* pool, ITask *const *const tasks, const uint32_t &count, const uint32_t &node)
+{
+	BoundedQueue<ITask*> *const queue = (node < pool->m_nodeQueues.size()) ? pool->m_nodeQueues[node] : pool->m_taskQueue[TASK_PRIORITY_NORMAL];
+	ITask *accepted[BATCH_CHUNK_SIZE];
+	uint32_t acceptedCount = 0;
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(registerTask(pool, tasks[i]))
+		{
+			accepted[acceptedCount++] = tasks[i];
+		}
+	}
+
+	if(acceptedCount < count)
+	{
+		MTHREAD_SEM_POST(&pool->m_semFree, count - acceptedCount);
+	}
+
+	//The whole chunk is published at once; cells that are still being read by a consumer will be released shortly
+	while((acceptedCount > 0) && (!queue->tryEnqueueBulk(accepted, acceptedCount)))
+	{
+		MTHREAD_YIELD();
+	}
+
+	//A single post wakes up at most as many idle workers as there are new tasks
+	signalTasks(pool, acceptedCount);
+}
+
+void ThreadPool::enqueueLocalBatch(Worker *const worker, ITask *const *const tasks, const size_t &count)
+{
+	uint32_t acceptedCount = 0;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		if(registerTask(worker->pool, tasks[i]))
+		{
+			worker->deque.push(tasks[i]);
+			acceptedCount++;
+		}
+	}
+
+	signalThieves(worker->pool, acceptedCount);
+}
+
+ITask *ThreadPool::fetchNextTask(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	ITask *task = NULL;
+
+	//More urgent tasks in the queue take precedence, but only if we can get hold of a signal for them
+	if(hasUrgentTasks(pool) && MTHREAD_SEM_TRYWAIT(&pool->m_semUsed))
+	{
+		if(ITask *const urgentTask = searchTask(pool, worker))
+		{
+			return urgentTask;
+		}
+	}
+
+	//Our own deque comes next, it is LIFO for the sake of cache locality; there is no signal to be taken for the task
+	if(popLocal(worker, task))
+	{
+		return task;
+	}
+
+	//Nothing to do, so the time until we find something counts as idle
+	const uint64_t idleSince = MTHREAD_TIME_NS();
+
+	if(pool->m_spinCount || pool->m_yieldCount)
+	{
+		task = spinForTask(worker);
+	}
+	else if(parkWorker(worker))
+	{
+		task = searchTask(pool, worker);
+	}
+
+	const uint64_t idleTime = MTHREAD_TIME_NS() - idleSince;
+	worker->counters.idleTime.fetch_add(idleTime, std::memory_order_relaxed);
+	TRACE_EVENT(pool, worker, TRACE_IDLE, NULL, idleSince, idleTime, 0);
+	return task;
+}
+
+ITask *ThreadPool::spinForTask(Worker *const worker)
+{
+	ThreadPool *const pool = worker->pool;
+	const uint32_t idleLimit = pool->m_spinCount + pool->m_yieldCount;
+
+	pool->m_spinning++;
+
+	//Keep looking for a while before going to sleep; producers do not wake anybody up while we are spinning
+	for(uint32_t i = 0; (i < idleLimit) && (!pool->m_bStopFlag); i++)
+	{
+		if(ITask *const task = searchTask(pool, worker))
+		{
+			leaveSpinning(pool);
+			return task;
+		}
+
+		if(i < pool->m_spinCount)
+		{
+			MTHREAD_PAUSE();
+		}
+		else
+		{
+			MTHREAD_YIELD();
+		}
+	}
+
+	//A producer may have skipped the wake-up because of us, so the last spinner has to take one more look before parking
+	if(pool->m_spinning.fetch_sub(1) == 1)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(ITask *const task = searchTask(pool, worker))
+		{
+			if(hasUnsignalledTasks(pool))
+			{
+				MTHREAD_SEM_POST(&pool->m_semUsed);
+			}
+			return task;
+		}
+	}
+
+	//After the wake-up we return empty-handed and start spinning again, so that we can hand over to the next worker
+	parkWorker(worker);
+	return NULL;
+}
+
+void ThreadPool::leaveSpinning(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	//Nobody is looking for unsignalled tasks anymore, so wake up a worker if there is still something left
+	if(pool->m_spinning.fetch_sub(1) == 1)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(hasUnsignalledTasks(pool))
+		{
+			MTHREAD_SEM_POST(&pool->m_semUsed);
+		}
+	}
+}
+
+bool ThreadPool::hasUnsignalledTasks(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	//Tasks in a deque only need a signal when there is a parked worker to steal them
+	return (!queuesEmpty(pool)) || ((pool->m_idleThreads.load() > 0) && (!dequesEmpty(pool)));
+}
+
+bool ThreadPool::hasQueuedTasks(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	return !(queuesEmpty(pool) && dequesEmpty(pool));
+}
+
+bool ThreadPool::dequesEmpty(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	for(uint32_t i = 0; i < pool->m_slotCount; i++)
+	{
+		if(!pool->m_workers[i].deque.empty())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+ITask *ThreadPool::tryFetchTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker)
+{
+	ITask *task = NULL;
+
+	//All workers may be helping out in a wait, in which case none of them is left in the processing loop to fire the timers
+	if(worker && (pool->m_nextTimer.load(std::memory_order_relaxed) != TimerWheel::NO_EXPIRY))
+	{
+		processTimers(worker);
+	}
+
+	if(worker && (!hasUrgentTasks(pool)) && popLocal(worker, task))
+	{
+		return task;
+	}
+
+	//While workers are spinning, tasks may have been queued without a signal, so we have to look for them anyway
+	const bool signalled = MTHREAD_SEM_TRYWAIT(&pool->m_semUsed);
+	if(signalled || (pool->m_spinning.load() > 0))
+	{
+		if(ITask *const queuedTask = searchTask(pool, worker))
+		{
+			return queuedTask;
+		}
+	}
+
+	//A signal without a task may have been meant to wake up a parked worker, e.g. to re-arm the timers, so pass it on
+	if(signalled)
+	{
+		MTHREAD_SEM_POST(&pool->m_semUsed);
+	}
+
+	//Tasks in the deques of busy workers come without a signal, so they are fair game for a helping thread at any time
+	bool contended = false;
+	if(stealTask(pool, worker, NO_NODE, task, contended))
+	{
+		passOver(pool, TASK_PRIORITY_NORMAL);
+		return task;
+	}
+
+	return (worker && popLocal(worker, task)) ? task : NULL;
+}
+
+ITask *ThreadPool::searchTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker)
+{
+	const uint32_t node = currentNode(pool, worker);
+	ITask *task = NULL;
+
+	//A signal means that a task is available, either in one of the global queues or in some worker's deque
+	while(!pool->m_bStopFlag)
+	{
+		if(dequeueAged(pool, node, task))
+		{
+			return task;
+		}
+
+		bool contended = false;
+		for(uint32_t priority = TASK_PRIORITY_COUNT; priority-- > 0;)
+		{
+			if(dequeueTask(pool, priority, node, task))
+			{
+				return task;
+			}
+			if((priority == TASK_PRIORITY_NORMAL) && stealTask(pool, worker, node, task, contended))
+			{
+				passOver(pool, priority);
+				return task;
+			}
+		}
+
+		//Only once there is nothing left on our own node, we take work from the other nodes
+		if(dequeueRemote(pool, node, task) || ((node != NO_NODE) && stealTask(pool, worker, NO_NODE, task, contended)))
+		{
+			passOver(pool, TASK_PRIORITY_NORMAL);
+			return task;
+		}
+
+		//The task might have been taken by its owner in the meantime; give up, unless a producer is still publishing
+		if(queuesEmpty(pool) && (!contended))
+		{
+			break;
+		}
+
+		MTHREAD_YIELD();
+	}
+
+	return NULL;
+}
+
+bool ThreadPool::popLocal(Worker *const worker, ITask *&task)
+{
+	if(worker->deque.pop(task))
+	{
+		passOver(worker->pool, TASK_PRIORITY_NORMAL);
+		return true;
+	}
+
+	return false;
+}
+
+bool ThreadPool::dequeueTask(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority, const uint32_t &node, ITask *&task)
+{
+	if(takeFromBand(pool, priority, node, task))
+	{
+		MTHREAD_SEM_POST(&pool->m_semFree);
+		passOver(pool, priority);
+		return true;
+	}
+
+	return false;
+}
+
+bool ThreadPool::dequeueAged(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &node, ITask *&task)
+{
+	//A band that has been passed over too often is served before all others, so that it cannot starve
+	for(uint32_t priority = 0; priority < TASK_PRIORITY_COUNT - 1; priority++)
+	{
+		if((pool->m_skipCount[priority].load(std::memory_order_relaxed) >= AGING_THRESHOLD) && takeFromBand(pool, priority, node, task))
+		{
+			pool->m_skipCount[priority].store(0, std::memory_order_relaxed);
+			MTHREAD_SEM_POST(&pool->m_semFree);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::dequeueRemote(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &node, ITask *&task)
+{
+	const uint32_t nodeCount = uint32_t(pool->m_nodeQueues.size());
+	const uint32_t first = (node < nodeCount) ? (node + 1) : 0;
+
+	//Start with the next node, so that the remote nodes are not all drained in the same order
+	for(uint32_t i = 0; i < nodeCount; i++)
+	{
+		const uint32_t remote = (first + i) % nodeCount;
+		if((remote != node) && pool->m_nodeQueues[remote]->tryDequeue(task))
+		{
+			MTHREAD_SEM_POST(&pool->m_semFree);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::takeFromBand(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority, const uint32_t &node, ITask *&task)
+{
+	if((priority == TASK_PRIORITY_NORMAL) && (node < pool->m_nodeQueues.size()) && pool->m_nodeQueues[node]->tryDequeue(task))
+	{
+		return true;
+	}
+
+	return pool->m_taskQueue[priority]->tryDequeue(task);
+}
+
+bool ThreadPool::bandEmpty(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority)
+{
+	if(!pool->m_taskQueue[priority]->empty())
+	{
+		return false;
+	}
+
+	if(priority == TASK_PRIORITY_NORMAL)
+	{
+		for(size_t i = 0; i < pool->m_nodeQueues.size(); i++)
+		{
+			if(!pool->m_nodeQueues[i]->empty())
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void ThreadPool::passOver(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority)
+{
+	//The counters saturate at the threshold, so they are not written over and over again while a band is waiting
+	for(uint32_t lower = 0; lower < priority; lower++)
+	{
+		if((pool->m_skipCount[lower].load(std::memory_order_relaxed) < AGING_THRESHOLD) && (!bandEmpty(pool, lower)))
+		{
+			pool->m_skipCount[lower].fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+bool ThreadPool::hasUrgentTasks(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	for(uint32_t priority = 0; priority < TASK_PRIORITY_COUNT; priority++)
+	{
+		const bool urgent = (priority > TASK_PRIORITY_NORMAL) || (pool->m_skipCount[priority].load(std::memory_order_relaxed) >= AGING_THRESHOLD);
+		if(urgent && (!bandEmpty(pool, priority)))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::queuesEmpty(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	for(uint32_t priority = 0; priority < TASK_PRIORITY_COUNT; priority++)
+	{
+		if(!bandEmpty(pool, priority))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ThreadPool::cooperativeWait(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	return (pool->m_flags & POOL_FLAG_COOPERATIVE_WAIT) != 0;
+}
+
+void ThreadPool::waitForSlot(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	//Only an actual wait is worth reading the clock
+	if(MTHREAD_SEM_TRYWAIT(&pool->m_semFree))
+	{
+		return;
+	}
+
+	const uint64_t blockedSince = MTHREAD_TIME_NS();
+	bool acquired = false;
+
+	//Blocking on a full queue from within a task could starve the pool, so help to drain the queue instead
+	if(cooperativeWait(pool))
+	{
+		helpWhile(pool, [pool, &acquired]() { return !(acquired = MTHREAD_SEM_TRYWAIT(&pool->m_semFree)); });
+	}
+
+	if(!acquired)
+	{
+		MTHREAD_SEM_WAIT(&pool->m_semFree);
+	}
+
+	countersOf(pool, currentWorker(pool))->blockedTime.fetch_add(MTHREAD_TIME_NS() - blockedSince, std::memory_order_relaxed);
+}
+
+template<typename Busy>
+void ThreadPool::helpWhile(MTHREADPOOL_NS::ThreadPool* pool, const Busy &busy)
+{
+	Worker *const worker = currentWorker(pool);
+	uint32_t idleCount = 0;
+
+	//Execute queued tasks until the target has completed; tasks may still be queued after we have been idle for a while
+	while(busy())
+	{
+		if(ITask *const task = tryFetchTask(pool, worker))
+		{
+			executeTask(pool, worker, task);
+			idleCount = 0;
+		}
+		else if(++idleCount < WAIT_SPIN_COUNT)
+		{
+			MTHREAD_YIELD();
+		}
+		else
+		{
+			parkHelper(pool, worker, busy);
+			idleCount = 0;
+		}
+	}
+}
+
+template<typename Busy>
+void ThreadPool::parkHelper(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, const Busy &busy)
+{
+	//Announce ourselves before the final check, so that a task that is queued or completed from now on will wake us up
+	const uint32_t epoch = pool->m_helpEpoch.load();
+	pool->m_parkedHelpers++;
+
+	if(busy() && (!hasQueuedTasks(pool)))
+	{
+		//A helping worker may be the only one left to fire the timers, so it must not sleep past the next one
+		const uint64_t nextTimer = worker ? pool->m_nextTimer.load() : TimerWheel::NO_EXPIRY;
+		if(nextTimer == TimerWheel::NO_EXPIRY)
+		{
+			ParkingLot::park(&pool->m_helpEpoch, epoch);
 		}
 		else
 		{
-			(*iter)->taskLaunched(task);
+			const uint64_t now = currentTime(pool);
+			if(nextTimer > now)
+			{
+				ParkingLot::park(&pool->m_helpEpoch, epoch, static_cast<uint32_t>(std::min<uint64_t>(nextTimer - now, UINT32_MAX)));
+			}
+		}
+	}
+
+	pool->m_parkedHelpers--;
+}
+
+void ThreadPool::wakeHelpers(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	//Parked helpers are rare, so this is usually just one load
+	if(pool->m_parkedHelpers.load() > 0)
+	{
+		pool->m_helpEpoch++;
+		ParkingLot::unpark(&pool->m_helpEpoch);
+	}
+}
+
+bool ThreadPool::stealTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const thief, const uint32_t &node, ITask *&task, bool &contended)
+{
+	//Threads outside of the pool (helping callers) have no deque of their own and no random state
+	uint32_t victim = (thief ? nextRandom(thief->randSeed) : pool->m_nextVictim++) % pool->m_slotCount;
+
+	for(uint32_t i = 0; i < pool->m_slotCount; i++)
+	{
+		if((!(thief && (victim == thief->index))) && ((node == NO_NODE) || (pool->m_workers[victim].node == node)))
+		{
+			switch(pool->m_workers[victim].deque.steal(task))
+			{
+			case WorkStealingDeque<ITask*>::STEAL_SUCCESS:
+				countersOf(pool, thief)->stolen.fetch_add(1, std::memory_order_relaxed);
+				TRACE_EVENT(pool, thief, TRACE_STEAL, task, 0, 0, uint16_t(victim));
+				return true;
+			case WorkStealingDeque<ITask*>::STEAL_ABORT:
+				contended = true;
+				break;
+			default:
+				break;
+			}
+		}
+
+		victim = (victim + 1) % pool->m_slotCount;
+	}
+
+	return false;
+}
+
+bool ThreadPool::claimTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, ITask* task)
+{
+	//A queue entry is dequeued exactly once, so a cancelled task can be dropped right here, nobody else is looking at it
+	uint32_t state = task->m_state.load();
+	while(!(state & TASK_STATE_CANCELLED))
+	{
+		if(task->m_state.compare_exchange_weak(state, state | TASK_STATE_RUNNING))
+		{
+			return true;
+		}
+	}
+
+	countersOf(pool, worker)->cancelled.fetch_add(1, std::memory_order_relaxed);
+	finalizeTask(pool, task);
+	return false;
+}
+
+void ThreadPool::finalizeTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task)
+{
+	//Waiters may destroy a user task as soon as they have been released, whereas pool-owned tasks destroy themselves in dispose()
+	const uint32_t owned = task->m_state.load() & ITask::STATE_OWNED;
+	if(!owned)
+	{
+		task->dispose();
+	}
+
+	//Only those threads that are actually waiting for this task get woken up
+	if(task->m_state.exchange(owned) & TASK_STATE_WAITERS)
+	{
+		ParkingLot::unpark(&task->m_state);
+	}
+
+	//The task must not be touched after this point
+	if(owned)
+	{
+		task->dispose();
+	}
+
+	if(--pool->m_pendingTasks == 0)
+	{
+		MTHREAD_MUTEX_LOCK(&pool->m_lockTask);
+		MTHREAD_COND_BROADCAST(&pool->m_condAllDone);
+		MTHREAD_MUTEX_UNLOCK(&pool->m_lockTask);
+	}
+
+	//A thread that parked while helping out may have been waiting for exactly this task, or for the graph it belongs to
+	wakeHelpers(pool);
+}
+
+void ThreadPool::notifyListeners(ThreadPool* pool, Worker *const worker, ITask* task, const bool &finished)
+{
+	//Without any listeners, there is nothing to do at all
+	if(!pool->m_listenerSnapshot.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	//In asynchronous mode, workers only leave a note for the dispatcher; helping threads have no ring, so they deliver directly
+	if(worker && worker->events)
+	{
+		postEvent(worker, task, finished);
+		return;
+	}
+
+	std::atomic<ListenerSnapshot*> *const hazard = worker ? &worker->listenerHazard : NULL;
+	if(const ListenerSnapshot *const snapshot = acquireSnapshot(pool, hazard))
+	{
+		deliverEvent(snapshot, task, finished);
+	}
+	releaseSnapshot(pool, hazard);
+}
+
+void ThreadPool::postEvent(Worker *const worker, ITask* task, const bool &finished)
+{
+	ListenerEvent event;
+	event.task = task;
+	event.finished = finished;
+
+	//Rather than to lose an event, we wait for the dispatcher to make room
+	if(!worker->events->tryPush(event))
+	{
+		MTHREAD_SEM_POST(&worker->pool->m_semDispatch);
+		while(!worker->events->tryPush(event))
+		{
+			MTHREAD_YIELD();
+		}
+	}
+}
+
+ThreadPool::ListenerSnapshot *ThreadPool::acquireSnapshot(MTHREADPOOL_NS::ThreadPool* pool, std::atomic<ListenerSnapshot*> *const hazard)
+{
+	//Threads without a hazard slot of their own are covered by a shared counter
+	if(!hazard)
+	{
+		pool->m_helperReaders++;
+		return pool->m_listenerSnapshot.load();
+	}
+
+	//Announce the snapshot, then make sure that it is still the current one; from then on, it will not be freed
+	ListenerSnapshot *snapshot = pool->m_listenerSnapshot.load();
+	for(;;)
+	{
+		hazard->store(snapshot);
+		ListenerSnapshot *const current = pool->m_listenerSnapshot.load();
+		if(current == snapshot)
+		{
+			return snapshot;
+		}
+		snapshot = current;
+	}
+}
+
+void ThreadPool::releaseSnapshot(MTHREADPOOL_NS::ThreadPool* pool, std::atomic<ListenerSnapshot*> *const hazard)
+{
+	if(hazard)
+	{
+		hazard->store(NULL, std::memory_order_release);
+	}
+	else
+	{
+		pool->m_helperReaders--;
+	}
+}
+
+void ThreadPool::publishListeners(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	ListenerSnapshot *snapshot = NULL;
+	if(!pool->m_listeners.empty())
+	{
+		snapshot = new ListenerSnapshot();
+		snapshot->listeners.assign(pool->m_listeners.begin(), pool->m_listeners.end());
+	}
+
+	ListenerSnapshot *const retired = pool->m_listenerSnapshot.exchange(snapshot);
+	if(!retired)
+	{
+		return;
+	}
+
+	//Readers that picked up the old snapshot may still be calling into it, so wait for them to finish (a grace period, as in RCU)
+	for(;;)
+	{
+		bool inUse = (pool->m_helperReaders.load() > 0) || (pool->m_dispatchHazard.load() == retired);
+		for(uint32_t i = 0; (i < pool->m_slotCount) && (!inUse); i++)
+		{
+			inUse = (pool->m_workers[i].listenerHazard.load() == retired);
+		}
+		if(!inUse)
+		{
+			break;
+		}
+		MTHREAD_YIELD();
+	}
+
+	delete retired;
+}
+
+void ThreadPool::recordEvent(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, const uint16_t &type, const void *const task, const uint64_t &time, const uint64_t &duration, const uint16_t &arg)
+{
+	TraceBuffer *const buffer = worker ? worker->trace : pool->m_sharedTrace;
+	if(!buffer)
+	{
+		return;
+	}
+
+	TraceEvent event;
+	event.time = time ? time : MTHREAD_TIME_NS();
+	event.duration = duration;
+	event.task = task;
+	event.type = type;
+	event.arg = arg;
+
+	//Threads outside of the pool share one buffer, so they are told apart by a hash of their ID
+	if(worker)
+	{
+		event.thread = worker->index + 1;
+		buffer->append(event);
+	}
+	else
+	{
+		event.thread = TRACE_SHARED_THREAD | uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFF);
+		buffer->appendShared(event);
+	}
+}
+
+void ThreadPool::deliverEvent(const ListenerSnapshot *const snapshot, ITask* task, const bool &finished)
+{
+	for(std::vector<IListener*>::const_iterator iter = snapshot->listeners.begin(); iter != snapshot->listeners.end(); iter++)
+	{
+		try
+		{
+			if(finished)
+			{
+				(*iter)->taskFinished(task);
+			}
+			else
+			{
+				(*iter)->taskLaunched(task);
+			}
+		}
+		catch(...)
+		{
+			LOG("Listener %p encountered an internal error!", *iter);
 		}
 	}
+}
 
-	MTHREAD_MUTEX_UNLOCK(&pool->m_lockListeners);
+void ThreadPool::dispatchLoop(MTHREADPOOL_NS::ThreadPool* pool)
+{
+	ListenerEvent batch[DISPATCH_BATCH];
+	uint32_t interval = DISPATCH_INTERVAL_MIN;
+
+	for(;;)
+	{
+		//Once the workers are gone, one more round picks up whatever they have left behind
+		const bool stopping = pool->m_dispatchStop.load();
+		size_t dispatched = 0;
+
+		//One batch per worker and round, so that a busy worker cannot hold up the others; the snapshot is taken once per batch
+		for(uint32_t i = 0; i < pool->m_slotCount; i++)
+		{
+			if(const size_t count = pool->m_workers[i].events->popBulk(batch, DISPATCH_BATCH))
+			{
+				if(const ListenerSnapshot *const snapshot = acquireSnapshot(pool, &pool->m_dispatchHazard))
+				{
+					for(size_t j = 0; j < count; j++)
+					{
+						deliverEvent(snapshot, batch[j].task, batch[j].finished);
+					}
+				}
+				releaseSnapshot(pool, &pool->m_dispatchHazard);
+				dispatched += count;
+			}
+		}
+
+		if(dispatched)
+		{
+			interval = DISPATCH_INTERVAL_MIN;
+			continue;
+		}
+
+		if(stopping)
+		{
+			break;
+		}
+
+		//Workers only signal us when a ring is full, otherwise we poll, less often the longer it stays quiet
+		MTHREAD_SEM_TIMEDWAIT(&pool->m_semDispatch, interval);
+		interval = std::min(interval * 2, DISPATCH_INTERVAL_MAX);
+	}
 }
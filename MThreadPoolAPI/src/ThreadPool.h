@@ -25,57 +25,254 @@
 
 #include "MThreadPoolAPI.h"
 #include "ThreadUtils.h"
+#include "BoundedQueue.h"
+#include "WorkStealingDeque.h"
+#include "TaskAllocator.h"
+#include "TimerWheel.h"
+#include "LatencyHistogram.h"
+#include "SpscRing.h"
+#include "TraceBuffer.h"
 
-#include <queue>
-#include <unordered_map>
+#include <atomic>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace MTHREADPOOL_NS
 {
 	class ThreadPool : public IPool
 	{
 	public:
-		ThreadPool(const uint32_t &threadCount = 0, const uint32_t &maxQueueLength = 0);
+		ThreadPool(const uint32_t &threadCount = 0, const uint32_t &maxQueueLength = 0, const uint32_t &flags = 0, const MTHREADPOOL_NS::PoolConfig &config = MTHREADPOOL_NS::PoolConfig());
 		virtual ~ThreadPool(void);
 
 		virtual bool schedule(MTHREADPOOL_NS::ITask *const task);
 		virtual bool trySchedule(MTHREADPOOL_NS::ITask *const task);
 
+		virtual bool schedule(MTHREADPOOL_NS::ITask *const task, const uint32_t &priority);
+		virtual bool trySchedule(MTHREADPOOL_NS::ITask *const task, const uint32_t &priority);
+
+		virtual bool scheduleBatch(MTHREADPOOL_NS::ITask *const *const tasks, const size_t &count);
+		virtual bool tryScheduleBatch(MTHREADPOOL_NS::ITask *const *const tasks, const size_t &count, size_t &scheduled);
+
+		virtual bool scheduleOnNode(MTHREADPOOL_NS::ITask *const task, const uint32_t &node);
+
+		virtual bool scheduleGraph(MTHREADPOOL_NS::ITaskGraph *const graph);
+
+		virtual bool scheduleAfter(MTHREADPOOL_NS::ITask *const task, const uint32_t &delay);
+		virtual bool scheduleEvery(MTHREADPOOL_NS::ITask *const task, const uint32_t &period);
+
+		virtual bool cancel(MTHREADPOOL_NS::ITask *const task);
+
 		virtual bool wait(void);
 		virtual bool wait(MTHREADPOOL_NS::ITask *const task);
+		virtual bool wait(MTHREADPOOL_NS::ITaskGraph *const graph);
+
+		virtual bool runPending(void);
+		virtual bool runPendingWhile(const std::atomic<uint32_t> &counter);
+		virtual bool enterBlocking(void);
+		virtual bool leaveBlocking(void);
+		virtual uint32_t getThreadCount(void) const;
+		virtual uint32_t getNodeCount(void) const;
+		virtual bool getStats(MTHREADPOOL_NS::PoolStats &stats) const;
+		virtual bool getLatency(const uint32_t &kind, MTHREADPOOL_NS::LatencyStats &stats) const;
+		virtual bool dumpTrace(const char *const fileName) const;
 
 		virtual bool addListener(MTHREADPOOL_NS::IListener *const listener);
 		virtual bool removeListener(MTHREADPOOL_NS::IListener *const listener);
 
+		virtual void *allocateTaskMemory(const size_t &size);
+		virtual void releaseTaskMemory(void *const memory, const size_t &size);
+
+		bool scheduleContinuation(MTHREADPOOL_NS::ITask *const task);
+
 	private:
-		volatile bool m_bStopFlag;
+		static const size_t CACHE_LINE = 64;
 
+		class Counters
+		{
+		public:
+			std::atomic<uint64_t> scheduled;
+			std::atomic<uint64_t> completed;
+			std::atomic<uint64_t> failed;
+			std::atomic<uint64_t> cancelled;
+			std::atomic<uint64_t> stolen;
+			std::atomic<uint64_t> busyTime;
+			std::atomic<uint64_t> idleTime;
+			std::atomic<uint64_t> blockedTime;
+			std::atomic<uint32_t> running;
+		};
+
+		class ListenerSnapshot
+		{
+		public:
+			std::vector<MTHREADPOOL_NS::IListener*> listeners;
+		};
+
+		class ListenerEvent
+		{
+		public:
+			MTHREADPOOL_NS::ITask *task;
+			bool finished;
+		};
+
+		class Worker
+		{
+		public:
+			MTHREADPOOL_NS::ThreadPool *pool;
+			uint32_t index;
+			uint32_t randSeed;
+			WorkStealingDeque<MTHREADPOOL_NS::ITask*> deque;
+			TaskAllocator::FreeList freeList;
+			std::atomic<ListenerSnapshot*> listenerHazard;
+			SpscRing<ListenerEvent> *events;
+			TraceBuffer *trace;
+			std::atomic<uint32_t> status;
+			uint32_t blockDepth;
+			bool compensated;
+			uint32_t node;
+			bool relocated;
+			char padding0[CACHE_LINE];
+			Counters counters;
+			LatencyHistogram latency[LATENCY_KIND_COUNT];
+			char padding1[CACHE_LINE];
+		};
+
+		std::atomic<bool> m_bStopFlag;
+
+		const uint32_t m_minThreads;
 		const uint32_t m_threadCount;
+		const uint32_t m_slotCount;
+		const uint32_t m_keepAlive;
+		const uint32_t m_spawnLatency;
 		const uint32_t m_maxQueueLength;
+		const uint32_t m_flags;
+		const uint32_t m_spinCount;
+		const uint32_t m_yieldCount;
+		const uint64_t m_timeBase;
 		
-		uint32_t m_runningTasks;
-		uint32_t m_nextCondIndex;
+		std::atomic<uint32_t> m_pendingTasks;
+		std::atomic<uint32_t> m_nextVictim;
+		std::atomic<uint32_t> m_spinning;
+		std::atomic<uint32_t> m_activeThreads;
+		std::atomic<uint32_t> m_idleThreads;
+		std::atomic<uint32_t> m_parkedHelpers;
+		std::atomic<uint32_t> m_helpEpoch;
+		std::atomic<uint32_t> m_lastSpawn;
+		std::atomic<uint32_t> m_blockedThreads;
+		std::atomic<uint32_t> m_surplusThreads;
+		std::atomic<uint32_t> m_cpuQuota;
+		std::atomic<uint32_t> m_quotaChecked;
 
 		pthread_t *m_threads;
+		Worker *m_workers;
 
-		sem_t m_semUsed;
-		sem_t m_semFree;
+		mthread_sem_t m_semUsed;
+		mthread_sem_t m_semFree;
 
 		pthread_mutex_t m_lockTask;
 		pthread_mutex_t m_lockListeners;
+		pthread_mutex_t m_lockThreads;
 
-		pthread_cond_t *m_condTaskDone;
 		pthread_cond_t m_condAllDone;
 
-		std::queue<MTHREADPOOL_NS::ITask*> m_taskQueue;
-		std::unordered_map<MTHREADPOOL_NS::ITask*,pthread_cond_t*> m_taskList;
+		BoundedQueue<MTHREADPOOL_NS::ITask*> *m_taskQueue[TASK_PRIORITY_COUNT];
+		std::atomic<uint32_t> m_skipCount[TASK_PRIORITY_COUNT];
+		TaskAllocator m_taskAllocator;
+		std::vector<uint32_t> m_cpuOrder;
+
+		std::vector<BoundedQueue<MTHREADPOOL_NS::ITask*>*> m_nodeQueues;
+		std::vector<std::vector<uint32_t> > m_nodeCpus;
+		std::vector<uint32_t> m_cpuNode;
 		std::set<MTHREADPOOL_NS::IListener*> m_listeners;
+		std::atomic<ListenerSnapshot*> m_listenerSnapshot;
+		std::atomic<uint32_t> m_helperReaders;
+
+		pthread_t m_dispatcher;
+		mthread_sem_t m_semDispatch;
+		std::atomic<ListenerSnapshot*> m_dispatchHazard;
+		std::atomic<bool> m_dispatchStop;
+
+		TraceBuffer *m_sharedTrace;
+		uint64_t m_traceBase;
+
+		pthread_mutex_t m_lockTimers;
+		TimerWheel m_timerWheel;
+		std::unordered_map<MTHREADPOOL_NS::ITask*, TimerWheel::Timer*> m_timers;
+		std::vector<TimerWheel::Timer*> m_expiredTimers;
+		std::atomic<uint64_t> m_nextTimer;
+		std::atomic<bool> m_timerKeeper;
+		std::atomic<bool> m_timerRearm;
+
+		char m_padding0[CACHE_LINE];
+		Counters m_sharedCounters;
+		LatencyHistogram m_sharedLatency[LATENCY_KIND_COUNT];
+		char m_padding1[CACHE_LINE];
 
 		static void *entryPoint(void *arg);
-		static void processingLoop(MTHREADPOOL_NS::ThreadPool* pool);
+		static void processingLoop(Worker *const worker);
+		static void *dispatchEntryPoint(void *arg);
+		static void dispatchLoop(MTHREADPOOL_NS::ThreadPool* pool);
 
-		static inline MTHREADPOOL_NS::ITask *fetchNextTask(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline Worker *currentWorker(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline Worker *localWorker(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline Counters *countersOf(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker);
+		static inline void resetCounters(Counters &counters);
+		static inline void addCounters(MTHREADPOOL_NS::PoolStats &stats, const Counters &counters);
+		static inline uint64_t valueAt(const std::vector<uint64_t> &counts, const uint64_t &total, const double &fraction);
+		static inline bool registerTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const bool &quiet = false);
+		static inline void setupNodes(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline uint32_t currentNode(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker);
+		static inline void enqueueTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const uint32_t &priority, const uint32_t &node);
+		static inline void enqueueLocal(Worker *const worker, ITask* task);
+		static inline uint32_t acquireSlots(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count, const bool &blocking);
+		static inline void enqueueBatch(MTHREADPOOL_NS::ThreadPool* pool, ITask *const *const tasks, const uint32_t &count, const uint32_t &node);
+		static inline void enqueueLocalBatch(Worker *const worker, ITask *const *const tasks, const size_t &count);
+		static inline uint64_t currentTime(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool addTimer(MTHREADPOOL_NS::ThreadPool* pool, ITask* task, const uint32_t &delay, const uint32_t &period);
+		static inline void processTimers(Worker *const worker);
+		static inline bool parkWorker(Worker *const worker);
+		static inline bool enterIdle(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool isElastic(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool spawnWorker(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline void growPool(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &queueWait);
+		static inline uint32_t growthLimit(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &now);
+		static inline bool retireWorker(Worker *const worker);
+		static inline bool retireSurplus(Worker *const worker);
+		static inline void signalTasks(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count);
+		static inline void signalThieves(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &count);
+		static inline MTHREADPOOL_NS::ITask *fetchNextTask(Worker *const worker);
+		static inline MTHREADPOOL_NS::ITask *spinForTask(Worker *const worker);
+		static inline bool popLocal(Worker *const worker, ITask *&task);
+		static inline bool dequeueTask(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority, const uint32_t &node, ITask *&task);
+		static inline bool dequeueAged(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &node, ITask *&task);
+		static inline bool dequeueRemote(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &node, ITask *&task);
+		static inline bool takeFromBand(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority, const uint32_t &node, ITask *&task);
+		static inline bool bandEmpty(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority);
+		static inline void passOver(MTHREADPOOL_NS::ThreadPool* pool, const uint32_t &priority);
+		static inline bool hasUrgentTasks(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool queuesEmpty(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline void leaveSpinning(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool hasUnsignalledTasks(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool hasQueuedTasks(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool dequesEmpty(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline MTHREADPOOL_NS::ITask *tryFetchTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker);
+		static inline MTHREADPOOL_NS::ITask *searchTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker);
+		static inline bool cooperativeWait(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline void waitForSlot(MTHREADPOOL_NS::ThreadPool* pool);
+		template<typename Busy> static inline void helpWhile(MTHREADPOOL_NS::ThreadPool* pool, const Busy &busy);
+		template<typename Busy> static inline void parkHelper(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, const Busy &busy);
+		static inline void wakeHelpers(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline bool stealTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const thief, const uint32_t &node, ITask *&task, bool &contended);
+		static inline bool claimTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, ITask* task);
+		static inline void executeTask(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, ITask* task);
 		static inline void finalizeTask(MTHREADPOOL_NS::ThreadPool* pool, ITask* task);
-		static inline void notifyListeners(MTHREADPOOL_NS::ThreadPool* pool, MTHREADPOOL_NS::ITask* task, const bool &finished);
+		static inline void notifyListeners(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, MTHREADPOOL_NS::ITask* task, const bool &finished);
+		static inline void postEvent(Worker *const worker, MTHREADPOOL_NS::ITask* task, const bool &finished);
+		static inline ListenerSnapshot *acquireSnapshot(MTHREADPOOL_NS::ThreadPool* pool, std::atomic<ListenerSnapshot*> *const hazard);
+		static inline void releaseSnapshot(MTHREADPOOL_NS::ThreadPool* pool, std::atomic<ListenerSnapshot*> *const hazard);
+		static inline void publishListeners(MTHREADPOOL_NS::ThreadPool* pool);
+		static inline void recordEvent(MTHREADPOOL_NS::ThreadPool* pool, Worker *const worker, const uint16_t &type, const void *const task, const uint64_t &time, const uint64_t &duration, const uint16_t &arg);
+		static inline void deliverEvent(const ListenerSnapshot *const snapshot, MTHREADPOOL_NS::ITask* task, const bool &finished);
 	};
 }
@@ -23,10 +23,45 @@
 
 #pragma once
 
+#include "ParkingLot.h"
+
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <ctime>
 #include <stdexcept>
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// pthreads-win32 extensions, not available with other implementations (e.g. glibc)
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef PTW32_CDECL
+#define PTW32_CDECL
+#endif
+
+#ifndef PTW32_VERSION
+static inline int sem_post_multiple(sem_t *const sem, const int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		if(sem_post(sem) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // Thread
 ///////////////////////////////////////////////////////////////////////////////
@@ -48,6 +83,60 @@ static inline void MTHREAD_JOIN(const pthread_t thread, void **value_ptr = NULL)
 	}
 }
 
+static inline void MTHREAD_YIELD(void)
+{
+	sched_yield();
+}
+
+static inline void MTHREAD_PAUSE(void)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline uint64_t MTHREAD_TIME_MS(void)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static inline uint64_t MTHREAD_TIME_NS(void)
+{
+#if defined(CLOCK_MONOTONIC_RAW)
+	//Not subject to NTP slewing, and served from the vDSO without a system call
+	struct timespec now;
+	if(clock_gettime(CLOCK_MONOTONIC_RAW, &now) == 0)
+	{
+		return (static_cast<uint64_t>(now.tv_sec) * 1000000000ULL) + static_cast<uint64_t>(now.tv_nsec);
+	}
+#endif
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static inline uint64_t MTHREAD_TIME_US(void)
+{
+	return MTHREAD_TIME_NS() / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Thread-specific data
+///////////////////////////////////////////////////////////////////////////////
+
+static inline void MTHREAD_SETSPECIFIC(const pthread_key_t &key, const void *const value)
+{
+	if(pthread_setspecific(key, value) != 0)
+	{
+		throw std::runtime_error("pthread_setspecific() failed!");
+	}
+}
+
+static inline void *MTHREAD_GETSPECIFIC(const pthread_key_t &key)
+{
+	return pthread_getspecific(key);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Mutex
 ///////////////////////////////////////////////////////////////////////////////
@@ -55,7 +144,7 @@ static inline void MTHREAD_JOIN(const pthread_t thread, void **value_ptr = NULL)
 static inline void MTHREAD_MUTEX_INIT(pthread_mutex_t *const mutex, const pthread_mutexattr_t *attr = NULL)
 {
 	memset(mutex, 0, sizeof(pthread_mutex_t));
-	if(pthread_mutex_init(mutex, NULL) != 0)
+	if(pthread_mutex_init(mutex, attr) != 0)
 	{
 		throw std::runtime_error("pthread_mutex_init() failed!");
 	}
@@ -69,6 +158,16 @@ static inline void MTHREAD_MUTEX_LOCK(pthread_mutex_t *const mutex)
 	}
 }
 
+static inline bool MTHREAD_MUTEX_TRYLOCK(pthread_mutex_t *const mutex)
+{
+	const int error = pthread_mutex_trylock(mutex);
+	if((error != 0) && (error != EBUSY))
+	{
+		throw std::runtime_error("pthread_mutex_trylock() failed!");
+	}
+	return (error == 0);
+}
+
 static inline void MTHREAD_MUTEX_UNLOCK(pthread_mutex_t *const mutex)
 {
 	if(pthread_mutex_unlock(mutex) != 0)
@@ -90,7 +189,103 @@ static inline void MTHREAD_MUTEX_DESTROY(pthread_mutex_t *const mutex)
 // Semaphore
 ///////////////////////////////////////////////////////////////////////////////
 
-static inline void MTHREAD_SEM_INIT(sem_t *const sem, const uint32_t &value)
+#ifdef __linux__
+
+//Counting semaphore on top of a futex: taking an available count, or posting while nobody is waiting, stays in user space
+typedef struct
+{
+	std::atomic<uint32_t> value;
+	std::atomic<uint32_t> waiters;
+}
+mthread_sem_t;
+
+static inline void MTHREAD_SEM_INIT(mthread_sem_t *const sem, const uint32_t &value)
+{
+	sem->value.store(value);
+	sem->waiters.store(0);
+}
+
+static inline bool MTHREAD_SEM_TRYWAIT(mthread_sem_t *const sem)
+{
+	uint32_t value = sem->value.load();
+	while(value > 0)
+	{
+		if(sem->value.compare_exchange_weak(value, value - 1))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline void MTHREAD_SEM_WAIT(mthread_sem_t *const sem)
+{
+	if(MTHREAD_SEM_TRYWAIT(sem))
+	{
+		return;
+	}
+
+	//Register as a waiter *before* re-checking the value, so that a concurrent post either sees us or we see its count
+	sem->waiters.fetch_add(1);
+	while(!MTHREAD_SEM_TRYWAIT(sem))
+	{
+		MTHREADPOOL_NS::ParkingLot::park(&sem->value, 0);
+	}
+	sem->waiters.fetch_sub(1);
+}
+
+static inline bool MTHREAD_SEM_TIMEDWAIT(mthread_sem_t *const sem, const uint32_t &timeout)
+{
+	if(MTHREAD_SEM_TRYWAIT(sem))
+	{
+		return true;
+	}
+
+	const uint64_t deadline = MTHREAD_TIME_MS() + timeout;
+	bool acquired = false;
+
+	sem->waiters.fetch_add(1);
+	while(!(acquired = MTHREAD_SEM_TRYWAIT(sem)))
+	{
+		const uint64_t now = MTHREAD_TIME_MS();
+		if(now >= deadline)
+		{
+			break;
+		}
+		MTHREADPOOL_NS::ParkingLot::park(&sem->value, 0, static_cast<uint32_t>(deadline - now));
+	}
+	sem->waiters.fetch_sub(1);
+
+	return acquired;
+}
+
+static inline void MTHREAD_SEM_POST(mthread_sem_t *const sem, const uint32_t &count = 1)
+{
+	if(count > 0)
+	{
+		sem->value.fetch_add(count);
+		if(sem->waiters.load() > 0)
+		{
+			//Wakes up to "count" waiters with a single system call
+			MTHREADPOOL_NS::ParkingLot::unpark(&sem->value, count);
+		}
+	}
+}
+
+static inline void MTHREAD_SEM_DESTROY(mthread_sem_t *const sem)
+{
+	if(sem->waiters.load() != 0)
+	{
+		throw std::runtime_error("Semaphore destroyed while threads are still waiting!");
+	}
+	sem->value.store(0);
+}
+
+#else //__linux__
+
+typedef sem_t mthread_sem_t;
+
+static inline void MTHREAD_SEM_INIT(mthread_sem_t *const sem, const uint32_t &value)
 {
 	memset(sem, 0, sizeof(sem_t));
 	if(sem_init(sem, 0, value) != 0)
@@ -99,7 +294,7 @@ static inline void MTHREAD_SEM_INIT(sem_t *const sem, const uint32_t &value)
 	}
 }
 
-static inline void MTHREAD_SEM_WAIT(sem_t *const sem)
+static inline void MTHREAD_SEM_WAIT(mthread_sem_t *const sem)
 {
 	if(sem_wait(sem) != 0)
 	{
@@ -107,7 +302,7 @@ static inline void MTHREAD_SEM_WAIT(sem_t *const sem)
 	}
 }
 
-static inline bool MTHREAD_SEM_TRYWAIT(sem_t *const sem)
+static inline bool MTHREAD_SEM_TRYWAIT(mthread_sem_t *const sem)
 {
 	if(sem_trywait(sem) != 0)
 	{
@@ -120,7 +315,25 @@ static inline bool MTHREAD_SEM_TRYWAIT(sem_t *const sem)
 	return true;
 }
 
-static inline void MTHREAD_SEM_POST(sem_t *const sem, const uint32_t &count = 1)
+static inline bool MTHREAD_SEM_TIMEDWAIT(mthread_sem_t *const sem, const uint32_t &timeout)
+{
+	const long long deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + (timeout * 1000000LL);
+	struct timespec abstime;
+	abstime.tv_sec = static_cast<time_t>(deadline / 1000000000LL);
+	abstime.tv_nsec = static_cast<long>(deadline % 1000000000LL);
+
+	if(sem_timedwait(sem, &abstime) != 0)
+	{
+		if((errno != ETIMEDOUT) && (errno != EINTR))
+		{
+			throw std::runtime_error("sem_timedwait() failed!");
+		}
+		return false;
+	}
+	return true;
+}
+
+static inline void MTHREAD_SEM_POST(mthread_sem_t *const sem, const uint32_t &count = 1)
 {
 	if(count > 1)
 	{
@@ -138,7 +351,7 @@ static inline void MTHREAD_SEM_POST(sem_t *const sem, const uint32_t &count = 1)
 	}
 }
 
-static inline void MTHREAD_SEM_DESTROY(sem_t *const sem)
+static inline void MTHREAD_SEM_DESTROY(mthread_sem_t *const sem)
 {
 	if(sem_destroy(sem) != 0)
 	{
@@ -147,6 +360,8 @@ static inline void MTHREAD_SEM_DESTROY(sem_t *const sem)
 	memset(sem, 0, sizeof(sem_t));
 }
 
+#endif //__linux__
+
 ///////////////////////////////////////////////////////////////////////////////
 // Conditional Var
 ///////////////////////////////////////////////////////////////////////////////
@@ -154,7 +369,7 @@ static inline void MTHREAD_SEM_DESTROY(sem_t *const sem)
 static inline void MTHREAD_COND_INIT(pthread_cond_t *const cond, const pthread_condattr_t *attr = NULL)
 {
 	memset(cond, 0, sizeof(pthread_cond_t));
-	if(pthread_cond_init(cond, NULL) != 0)
+	if(pthread_cond_init(cond, attr) != 0)
 	{
 		throw std::runtime_error("pthread_cond_init() failed!");
 	}
@@ -0,0 +1,192 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+using namespace MTHREADPOOL_NS;
+
+static const uint64_t MAX_DELTA = (1ULL << (TimerWheel::LEVEL_COUNT * TimerWheel::SLOT_BITS)) - 1ULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+
+TimerWheel::TimerWheel(void)
+:
+	m_current(0),
+	m_size(0)
+{
+	for(uint32_t level = 0; level < LEVEL_COUNT; level++)
+	{
+		m_count[level] = 0;
+		for(uint32_t slot = 0; slot < SLOT_COUNT; slot++)
+		{
+			m_slots[level][slot].prev = m_slots[level][slot].next = &m_slots[level][slot];
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Insert and remove
+///////////////////////////////////////////////////////////////////////////////
+
+void TimerWheel::insert(Timer *const timer, const uint64_t &now)
+{
+	//An empty wheel does not need to catch up with the clock
+	if((m_size == 0) && (now > m_current))
+	{
+		m_current = now;
+	}
+
+	place(timer, m_current + 1ULL);
+	m_size++;
+}
+
+void TimerWheel::remove(Timer *const timer)
+{
+	unlink(timer);
+	m_count[timer->level]--;
+	m_size--;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Advance the wheel
+///////////////////////////////////////////////////////////////////////////////
+
+void TimerWheel::advance(const uint64_t &now, std::vector<Timer*> &expired)
+{
+	while(m_current < now)
+	{
+		//Nothing can happen before the next boundary of the lowest level that is occupied, so skip the ticks in between
+		uint32_t level = 0;
+		while((level < LEVEL_COUNT) && (m_count[level] == 0))
+		{
+			level++;
+		}
+		if(level >= LEVEL_COUNT)
+		{
+			m_current = now;
+			break;
+		}
+		if(level > 0)
+		{
+			const uint64_t lastTick = m_current | ((1ULL << (level * SLOT_BITS)) - 1ULL);
+			if(lastTick >= now)
+			{
+				m_current = now;
+				break;
+			}
+			m_current = lastTick;
+		}
+
+		m_current++;
+
+		//Timers of the higher levels trickle down when the lower levels wrap around
+		for(uint32_t i = LEVEL_COUNT - 1; i > 0; i--)
+		{
+			if((m_current & ((1ULL << (i * SLOT_BITS)) - 1ULL)) == 0)
+			{
+				cascade(i);
+			}
+		}
+
+		Link *const head = &m_slots[0][m_current & (SLOT_COUNT - 1)];
+		while(head->next != head)
+		{
+			Timer *const timer = static_cast<Timer*>(head->next);
+			remove(timer);
+			expired.push_back(timer);
+		}
+	}
+}
+
+uint64_t TimerWheel::nextExpiry(void) const
+{
+	//Returns the next tick on which a timer expires or gets moved to a lower level, whichever comes first
+	for(uint32_t level = 0; level < LEVEL_COUNT; level++)
+	{
+		if(m_count[level] > 0)
+		{
+			const uint64_t base = m_current >> (level * SLOT_BITS);
+			for(uint64_t i = 1; i <= SLOT_COUNT; i++)
+			{
+				const Link *const head = &m_slots[level][(base + i) & (SLOT_COUNT - 1)];
+				if(head->next != head)
+				{
+					return (base + i) << (level * SLOT_BITS);
+				}
+			}
+		}
+	}
+
+	return NO_EXPIRY;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+///////////////////////////////////////////////////////////////////////////////
+
+void TimerWheel::place(Timer *const timer, const uint64_t &earliest)
+{
+	//Timers that are already due fire on the earliest tick still to be processed, timers beyond the range of the wheel get re-inserted on the way
+	uint64_t expiry = std::max(timer->expiry, earliest);
+	if((expiry - m_current) > MAX_DELTA)
+	{
+		expiry = m_current + MAX_DELTA;
+	}
+
+	uint32_t level = 0;
+	while((level < LEVEL_COUNT - 1) && ((expiry - m_current) >= (1ULL << ((level + 1) * SLOT_BITS))))
+	{
+		level++;
+	}
+
+	Link *const head = &m_slots[level][(expiry >> (level * SLOT_BITS)) & (SLOT_COUNT - 1)];
+	timer->level = level;
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+	m_count[level]++;
+}
+
+void TimerWheel::cascade(const uint32_t &level)
+{
+	Link *const head = &m_slots[level][(m_current >> (level * SLOT_BITS)) & (SLOT_COUNT - 1)];
+	while(head->next != head)
+	{
+		Timer *const timer = static_cast<Timer*>(head->next);
+		unlink(timer);
+		m_count[level]--;
+		place(timer, m_current);
+	}
+}
+
+void TimerWheel::unlink(Link *const link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link->next = link;
+}
@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MThreadPoolAPI.h"
+
+#include <vector>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Hierarchical timer wheel (Varghese & Lauck), one tick per millisecond
+	///////////////////////////////////////////////////////////////////////////
+
+	class TimerWheel
+	{
+	public:
+		static const uint32_t LEVEL_COUNT = 4;
+		static const uint32_t SLOT_BITS = 8;
+		static const uint32_t SLOT_COUNT = 1U << SLOT_BITS;
+		static const uint64_t NO_EXPIRY = UINT64_MAX;
+
+		class Link
+		{
+		public:
+			Link *prev;
+			Link *next;
+		};
+
+		class Timer : public Link
+		{
+		public:
+			MTHREADPOOL_NS::ITask *task;
+			uint64_t expiry;
+			uint32_t period;
+			uint32_t level;
+		};
+
+		TimerWheel(void);
+
+		void insert(Timer *const timer, const uint64_t &now);
+		void remove(Timer *const timer);
+		void advance(const uint64_t &now, std::vector<Timer*> &expired);
+
+		uint64_t nextExpiry(void) const;
+		size_t size(void) const { return m_size; }
+
+	private:
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel &operator=(const TimerWheel&) = delete;
+
+		inline void place(Timer *const timer, const uint64_t &earliest);
+		inline void cascade(const uint32_t &level);
+		static inline void unlink(Link *const link);
+
+		uint64_t m_current;
+		size_t m_size;
+		uint32_t m_count[LEVEL_COUNT];
+		Link m_slots[LEVEL_COUNT][SLOT_COUNT];
+	};
+}
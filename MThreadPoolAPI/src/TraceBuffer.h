@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Trace ring buffer, keeps the most recent events (flight recorder)
+	///////////////////////////////////////////////////////////////////////////
+
+	class TraceEvent
+	{
+	public:
+		uint64_t time;     /*nanoseconds*/
+		uint64_t duration; /*nanoseconds, for spans only*/
+		const void *task;  /*identifies the task, must not be dereferenced*/
+		uint32_t thread;
+		uint16_t type;
+		uint16_t arg;
+	};
+
+	class TraceBuffer
+	{
+	public:
+		TraceBuffer(const uint32_t &capacity)
+		{
+			m_capacity = 2;
+			while(m_capacity < capacity)
+			{
+				m_capacity <<= 1;
+			}
+
+			m_mask = m_capacity - 1;
+			m_slots = new Slot[m_capacity];
+			for(size_t i = 0; i < m_capacity; i++)
+			{
+				m_slots[i].sequence.store(0, std::memory_order_relaxed);
+			}
+			m_next.store(0, std::memory_order_relaxed);
+		}
+
+		~TraceBuffer(void)
+		{
+			delete [] m_slots;
+		}
+
+		inline void append(const TraceEvent &event) /*single writer*/
+		{
+			const size_t next = m_next.load(std::memory_order_relaxed);
+			m_next.store(next + 1, std::memory_order_relaxed);
+			write(next, event);
+		}
+
+		inline void appendShared(const TraceEvent &event) /*any number of writers*/
+		{
+			write(m_next.fetch_add(1, std::memory_order_relaxed), event);
+		}
+
+		inline void copyTo(std::vector<TraceEvent> &events) const
+		{
+			//The writers keep going, so an event that is being written, or has been overwritten meanwhile, is skipped
+			const size_t next = m_next.load(std::memory_order_relaxed);
+			TraceEvent event;
+			for(size_t i = (next > m_capacity) ? (next - m_capacity) : 0; i < next; i++)
+			{
+				if(read(i, event))
+				{
+					events.push_back(event);
+				}
+			}
+		}
+
+	private:
+		TraceBuffer(const TraceBuffer&) = delete;
+		TraceBuffer &operator=(const TraceBuffer&) = delete;
+
+		//A sequence number of 2 * (index + 1) marks a complete event; the odd value in between marks a write in progress
+		class Slot
+		{
+		public:
+			std::atomic<size_t> sequence;
+			std::atomic<uint64_t> time;
+			std::atomic<uint64_t> duration;
+			std::atomic<const void*> task;
+			std::atomic<uint64_t> info; /*thread, type and arg*/
+		};
+
+		inline void write(const size_t &index, const TraceEvent &event)
+		{
+			Slot &slot = m_slots[index & m_mask];
+			slot.sequence.store((2 * index) + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.time.store(event.time, std::memory_order_relaxed);
+			slot.duration.store(event.duration, std::memory_order_relaxed);
+			slot.task.store(event.task, std::memory_order_relaxed);
+			slot.info.store((uint64_t(event.thread) << 32) | (uint64_t(event.type) << 16) | uint64_t(event.arg), std::memory_order_relaxed);
+			slot.sequence.store((2 * index) + 2, std::memory_order_release);
+		}
+
+		inline bool read(const size_t &index, TraceEvent &event) const
+		{
+			const Slot &slot = m_slots[index & m_mask];
+			const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if(sequence != ((2 * index) + 2))
+			{
+				return false;
+			}
+
+			event.time = slot.time.load(std::memory_order_relaxed);
+			event.duration = slot.duration.load(std::memory_order_relaxed);
+			event.task = slot.task.load(std::memory_order_relaxed);
+			const uint64_t info = slot.info.load(std::memory_order_relaxed);
+			event.thread = uint32_t(info >> 32);
+			event.type = uint16_t(info >> 16);
+			event.arg = uint16_t(info);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.sequence.load(std::memory_order_relaxed) == sequence;
+		}
+
+		Slot *m_slots;
+		size_t m_mask;
+		size_t m_capacity;
+		std::atomic<size_t> m_next;
+	};
+}
@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace MTHREADPOOL_NS
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Work-stealing deque (Chase/Lev, with C11 memory model by Le et al.)
+	// Only the owner thread may call push() and pop(), any thread may steal()
+	///////////////////////////////////////////////////////////////////////////
+
+	template<typename T>
+	class WorkStealingDeque
+	{
+	public:
+		typedef enum
+		{
+			STEAL_SUCCESS = 0,
+			STEAL_EMPTY   = 1,
+			STEAL_ABORT   = 2
+		}
+		steal_result_t;
+
+		WorkStealingDeque(const uint32_t &initialCapacity = 256)
+		{
+			size_t capacity = 2;
+			while(capacity < initialCapacity)
+			{
+				capacity <<= 1;
+			}
+
+			m_top.store(0, std::memory_order_relaxed);
+			m_bottom.store(0, std::memory_order_relaxed);
+			m_array.store(new Array(capacity), std::memory_order_relaxed);
+		}
+
+		~WorkStealingDeque(void)
+		{
+			delete m_array.load(std::memory_order_relaxed);
+			for(size_t i = 0; i < m_garbage.size(); i++)
+			{
+				delete m_garbage[i];
+			}
+		}
+
+		inline void push(const T &value)
+		{
+			const int64_t b = m_bottom.load(std::memory_order_relaxed);
+			const int64_t t = m_top.load(std::memory_order_acquire);
+			Array *a = m_array.load(std::memory_order_relaxed);
+
+			if((b - t) > int64_t(a->mask))
+			{
+				a = grow(a, b, t);
+			}
+
+			//A release store instead of a fence, so that race detectors can see what a thief synchronizes with
+			a->put(b, value);
+			m_bottom.store(b + 1, std::memory_order_release);
+		}
+
+		inline bool pop(T &value)
+		{
+			const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+			Array *const a = m_array.load(std::memory_order_relaxed);
+			m_bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = m_top.load(std::memory_order_relaxed);
+
+			if(t > b)
+			{
+				m_bottom.store(b + 1, std::memory_order_relaxed);
+				return false; /*deque is empty*/
+			}
+
+			value = a->get(b);
+
+			if(t == b)
+			{
+				//This was the last element, we have to race against the thieves
+				const bool success = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+				m_bottom.store(b + 1, std::memory_order_relaxed);
+				return success;
+			}
+
+			return true;
+		}
+
+		inline steal_result_t steal(T &value)
+		{
+			int64_t t = m_top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const int64_t b = m_bottom.load(std::memory_order_acquire);
+
+			if(t >= b)
+			{
+				return STEAL_EMPTY;
+			}
+
+			Array *const a = m_array.load(std::memory_order_acquire);
+			value = a->get(t);
+
+			if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				return STEAL_ABORT; /*lost the race against another thief or the owner*/
+			}
+
+			return STEAL_SUCCESS;
+		}
+
+		void relocate(void)
+		{
+			//Owner only; the buffer is re-allocated by the calling thread, so that it ends up in that thread's local memory
+			const int64_t b = m_bottom.load(std::memory_order_relaxed);
+			const int64_t t = m_top.load(std::memory_order_acquire);
+			Array *const a = m_array.load(std::memory_order_relaxed);
+			replace(a, new Array(a->mask + 1), b, t);
+		}
+
+		inline size_t size(void) const
+		{
+			const int64_t b = m_bottom.load(std::memory_order_relaxed);
+			const int64_t t = m_top.load(std::memory_order_relaxed);
+			return (b > t) ? size_t(b - t) : 0;
+		}
+
+		inline bool empty(void) const
+		{
+			return (size() == 0);
+		}
+
+	private:
+		WorkStealingDeque(const WorkStealingDeque&) = delete;
+		WorkStealingDeque &operator=(const WorkStealingDeque&) = delete;
+
+		struct Array
+		{
+			Array(const size_t &capacity) : mask(capacity - 1)
+			{
+				buffer = new std::atomic<T>[capacity];
+			}
+
+			~Array(void)
+			{
+				delete [] buffer;
+			}
+
+			inline T get(const int64_t &index) const
+			{
+				return buffer[size_t(index) & mask].load(std::memory_order_relaxed);
+			}
+
+			inline void put(const int64_t &index, const T &value)
+			{
+				buffer[size_t(index) & mask].store(value, std::memory_order_relaxed);
+			}
+
+			const size_t mask;
+			std::atomic<T> *buffer;
+		};
+
+		Array *grow(Array *const oldArray, const int64_t &b, const int64_t &t)
+		{
+			return replace(oldArray, new Array(2 * (oldArray->mask + 1)), b, t);
+		}
+
+		Array *replace(Array *const oldArray, Array *const newArray, const int64_t &b, const int64_t &t)
+		{
+			for(int64_t i = t; i < b; i++)
+			{
+				newArray->put(i, oldArray->get(i));
+			}
+
+			//Thieves may still be reading from the old array, so it is retired until the deque is destroyed
+			m_garbage.push_back(oldArray);
+			m_array.store(newArray, std::memory_order_release);
+			return newArray;
+		}
+
+		static const size_t CACHE_LINE = 64;
+
+		char m_pad0[CACHE_LINE];
+		std::atomic<int64_t> m_top;
+		char m_pad1[CACHE_LINE - sizeof(std::atomic<int64_t>)];
+		std::atomic<int64_t> m_bottom;
+		std::atomic<Array*> m_array;
+		char m_pad2[CACHE_LINE - sizeof(std::atomic<int64_t>) - sizeof(std::atomic<Array*>)];
+		std::vector<Array*> m_garbage;
+	};
+}
@@ -0,0 +1,474 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+
+#include "MThreadPoolAPI.h"
+
+#include <sha1.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <vld.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Workloads
+///////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t TINY_LOOPS = 64;
+static const uint32_t SHA1_LOOPS = 256;
+static const size_t MEMORY_SIZE = 64 * 1024 * 1024; /*bytes, larger than the last-level cache*/
+static const size_t MEMORY_CHUNK = 1024 * 1024;
+static const uint32_t FORK_JOIN_GRAIN = 64;
+
+static std::atomic<uint64_t> g_sink(0);
+static uint64_t *g_memory = NULL;
+
+static inline void consume(const uint64_t &value)
+{
+	//Keeps the compiler from optimizing the work away, without making all threads write to the same cache line
+	if(value == 0x5DEECE66DULL)
+	{
+		g_sink.fetch_add(1);
+	}
+}
+
+static inline uint64_t spin(uint64_t state, const uint32_t &loops)
+{
+	for(uint32_t i = 0; i < loops; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+	}
+	return state;
+}
+
+static void runEmpty(const uint32_t &/*index*/)
+{
+	/*pure scheduling overhead*/
+}
+
+static void runTiny(const uint32_t &index)
+{
+	consume(spin(index + 1, TINY_LOOPS));
+}
+
+static void runSha1(const uint32_t &index)
+{
+	unsigned char hash[20], temp[20];
+	memset(temp, 0, sizeof(temp));
+	memcpy(temp, &index, sizeof(uint32_t));
+
+	for(uint32_t i = 0; i < SHA1_LOOPS; i++)
+	{
+		sha1::calc(temp, 20, hash);
+		memcpy(temp, hash, sizeof(hash));
+	}
+
+	uint64_t result;
+	memcpy(&result, hash, sizeof(uint64_t));
+	consume(result);
+}
+
+static void runMemory(const uint32_t &index)
+{
+	//Each task streams through its own chunk, neighbouring tasks touch different chunks
+	const size_t words = MEMORY_CHUNK / sizeof(uint64_t);
+	const uint64_t *const chunk = g_memory + (((size_t(index) * MEMORY_CHUNK) % MEMORY_SIZE) / sizeof(uint64_t));
+
+	uint64_t sum = 0;
+	for(size_t i = 0; i < words; i++)
+	{
+		sum += chunk[i];
+	}
+	consume(sum);
+}
+
+static void runImbalanced(const uint32_t &index)
+{
+	//Heavy-tailed durations: the cost doubles from one class to the next, the classes are equally likely
+	const uint64_t hash = spin(index + 1, 4);
+	consume(spin(hash, TINY_LOOPS << (hash % 10)));
+}
+
+class Workload
+{
+public:
+	const char *name;
+	uint32_t taskCount; /*default number of tasks, or of elements for fork-join*/
+	void (*function)(const uint32_t &index);
+	bool forkJoin;
+};
+
+static const Workload WORKLOADS[] =
+{
+	{ "empty",      262144, runEmpty,      false },
+	{ "tiny",       262144, runTiny,       false },
+	{ "sha1",       8192,   runSha1,       false },
+	{ "memory",     1024,   runMemory,     false },
+	{ "imbalanced", 16384,  runImbalanced, false },
+	{ "forkjoin",   1048576, runTiny,      true  },
+	{ NULL, 0, NULL, false }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Options
+///////////////////////////////////////////////////////////////////////////////
+
+class Options
+{
+public:
+	std::vector<std::string> workloads;
+	std::vector<uint32_t> threads;
+	std::vector<uint32_t> producers;
+	uint32_t flags;
+	uint32_t queueLength;
+	MTHREADPOOL_NS::PoolConfig config;
+	uint32_t repeat;
+	double scale;
+	bool json;
+	const char *output;
+};
+
+static std::vector<std::string> splitList(const char *const text)
+{
+	std::vector<std::string> items;
+	std::string current;
+
+	for(const char *c = text; ; c++)
+	{
+		if((*c == ',') || (*c == '\0'))
+		{
+			if(!current.empty())
+			{
+				items.push_back(current);
+			}
+			current.clear();
+			if(*c == '\0')
+			{
+				break;
+			}
+		}
+		else
+		{
+			current += *c;
+		}
+	}
+
+	return items;
+}
+
+static std::vector<uint32_t> splitNumbers(const char *const text)
+{
+	std::vector<uint32_t> numbers;
+	const std::vector<std::string> items = splitList(text);
+	for(size_t i = 0; i < items.size(); i++)
+	{
+		numbers.push_back(uint32_t(strtoul(items[i].c_str(), NULL, 0)));
+	}
+	return numbers;
+}
+
+static void printUsage(void)
+{
+	fprintf(stderr, "Usage: MThreadPoolBench [options]\n\n");
+	fprintf(stderr, "  --workloads=a,b,...  empty, tiny, sha1, memory, imbalanced, forkjoin (default: all)\n");
+	fprintf(stderr, "  --threads=n,m,...    Worker counts to sweep (default: powers of two up to the number of processors)\n");
+	fprintf(stderr, "  --producers=n,m,...  Producer thread counts to sweep, ignored for forkjoin (default: 1)\n");
+	fprintf(stderr, "  --flags=n            Pool flags, e.g. 1 for work stealing (default: 0)\n");
+	fprintf(stderr, "  --queue=n            Maximum queue length (default: chosen by the pool)\n");
+	fprintf(stderr, "  --spin=n             Times an idle worker polls before it yields (default: 0)\n");
+	fprintf(stderr, "  --yield=n            Times an idle worker yields before it parks (default: 0)\n");
+	fprintf(stderr, "  --max-threads=n      Lets the pool grow up to n workers while tasks are waiting (default: no growth)\n");
+	fprintf(stderr, "  --scale=x            Multiplies the number of tasks (default: 1.0)\n");
+	fprintf(stderr, "  --repeat=n           Runs each configuration n times, with a fresh pool (default: 1)\n");
+	fprintf(stderr, "  --format=csv|json    Output format (default: csv)\n");
+	fprintf(stderr, "  --output=file        Output file (default: stdout)\n");
+}
+
+static bool parseOptions(const int argc, char *argv[], Options &options)
+{
+	options.flags = 0;
+	options.queueLength = 0;
+	options.repeat = 1;
+	options.scale = 1.0;
+	options.json = false;
+	options.output = NULL;
+
+	for(int i = 1; i < argc; i++)
+	{
+		const char *const arg = argv[i];
+		const char *const value = strchr(arg, '=');
+		const std::string name = value ? std::string(arg, value - arg) : std::string(arg);
+
+		if((name == "--workloads") && value)   options.workloads = splitList(value + 1);
+		else if((name == "--threads") && value)   options.threads = splitNumbers(value + 1);
+		else if((name == "--producers") && value) options.producers = splitNumbers(value + 1);
+		else if((name == "--flags") && value)     options.flags = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--queue") && value)     options.queueLength = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--spin") && value)      options.config.spinCount = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--yield") && value)     options.config.yieldCount = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--max-threads") && value) options.config.maxThreadCount = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--scale") && value)     options.scale = atof(value + 1);
+		else if((name == "--repeat") && value)    options.repeat = uint32_t(strtoul(value + 1, NULL, 0));
+		else if((name == "--format") && value)    options.json = (strcmp(value + 1, "json") == 0);
+		else if((name == "--output") && value)    options.output = value + 1;
+		else
+		{
+			fprintf(stderr, "Unknown option \"%s\"!\n\n", arg);
+			return false;
+		}
+	}
+
+	if(options.workloads.empty())
+	{
+		for(const Workload *workload = WORKLOADS; workload->name; workload++)
+		{
+			options.workloads.push_back(workload->name);
+		}
+	}
+
+	if(options.threads.empty())
+	{
+		const uint32_t processors = std::max(std::thread::hardware_concurrency(), 1U);
+		for(uint32_t n = 1; n < processors; n <<= 1)
+		{
+			options.threads.push_back(n);
+		}
+		options.threads.push_back(processors);
+	}
+
+	if(options.producers.empty())
+	{
+		options.producers.push_back(1);
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark
+///////////////////////////////////////////////////////////////////////////////
+
+class Result
+{
+public:
+	uint64_t tasks;
+	double seconds;
+	double overhead; /*nanoseconds per task that the workers did not spend in run(), idle time included*/
+	MTHREADPOOL_NS::PoolStats stats;
+	MTHREADPOOL_NS::LatencyStats wait;
+	MTHREADPOOL_NS::LatencyStats run;
+};
+
+static void produce(MTHREADPOOL_NS::IPool *const pool, const Workload *const workload, const uint32_t first, const uint32_t step, const uint32_t taskCount)
+{
+	void (*const function)(const uint32_t&) = workload->function;
+	for(uint32_t i = first; i < taskCount; i += step)
+	{
+		if(!pool->schedule([function, i]() { function(i); }))
+		{
+			fprintf(stderr, "Scheduling has failed!\n");
+			return;
+		}
+	}
+}
+
+static bool runBenchmark(const Workload *const workload, const Options &options, const uint32_t &threads, const uint32_t &producers, Result &result)
+{
+	const uint32_t taskCount = std::max(uint32_t(workload->taskCount * options.scale), 1U);
+
+	MTHREADPOOL_NS::IPool *const pool = MTHREADPOOL_NS::allocatePool(threads, options.queueLength, options.flags, options.config);
+	if(!pool)
+	{
+		fprintf(stderr, "Failed to allocate pool!\n");
+		return false;
+	}
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if(workload->forkJoin)
+	{
+		//The calling thread splits the range recursively and helps out until all halves have been joined
+		void (*const function)(const uint32_t&) = workload->function;
+		consume(MTHREADPOOL_NS::parallelReduce(pool, 0, taskCount, uint64_t(0),
+			[function](const size_t &first, const size_t &last, const uint64_t &init) { for(size_t i = first; i < last; i++) function(uint32_t(i)); return init + (last - first); },
+			[](const uint64_t &lower, const uint64_t &upper) { return lower + upper; },
+			FORK_JOIN_GRAIN));
+	}
+	else
+	{
+		std::vector<std::thread> producerThreads;
+		for(uint32_t p = 0; p < producers; p++)
+		{
+			producerThreads.push_back(std::thread(produce, pool, workload, p, producers, taskCount));
+		}
+		for(size_t p = 0; p < producerThreads.size(); p++)
+		{
+			producerThreads[p].join();
+		}
+		pool->wait();
+	}
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	pool->getStats(result.stats);
+	pool->getLatency(MTHREADPOOL_NS::LATENCY_QUEUE_WAIT, result.wait);
+	pool->getLatency(MTHREADPOOL_NS::LATENCY_RUN_TIME, result.run);
+	MTHREADPOOL_NS::destroyPool(pool);
+
+	//For fork-join, the tasks are the sub-ranges that have been split off
+	result.tasks = workload->forkJoin ? std::max<uint64_t>(result.stats.tasksScheduled, 1) : taskCount;
+
+	double busy = 0.0;
+	for(size_t i = 0; i < result.stats.workers.size(); i++)
+	{
+		busy += double(result.stats.workers[i].busyTime) * 1000.0;
+	}
+	result.overhead = std::max(((result.seconds * 1e9 * threads) - busy) / double(result.tasks), 0.0);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Output
+///////////////////////////////////////////////////////////////////////////////
+
+static void writeResult(FILE *const out, const bool &json, const bool &first, const char *const name, const uint32_t &threads, const uint32_t &producers, const Result &result)
+{
+	const unsigned long long tasks = result.tasks;
+	const double tasksPerSec = double(result.tasks) / result.seconds, nsPerTask = (result.seconds * 1e9) / double(result.tasks);
+
+	if(json)
+	{
+		fprintf(out, "%s\n  {\"workload\":\"%s\",\"threads\":%u,\"producers\":%u,\"tasks\":%llu,\"seconds\":%.6f,\"tasks_per_sec\":%.1f,\"ns_per_task\":%.1f,\"overhead_ns_per_task\":%.1f,", first ? "" : ",", name, threads, producers, tasks, result.seconds, tasksPerSec, nsPerTask, result.overhead);
+		fprintf(out, "\"wait_p50_ns\":%llu,\"wait_p99_ns\":%llu,\"wait_p999_ns\":%llu,\"run_p50_ns\":%llu,\"run_p99_ns\":%llu,\"run_p999_ns\":%llu,", (unsigned long long)result.wait.p50, (unsigned long long)result.wait.p99, (unsigned long long)result.wait.p999, (unsigned long long)result.run.p50, (unsigned long long)result.run.p99, (unsigned long long)result.run.p999);
+		fprintf(out, "\"steals\":%llu,\"schedule_blocked_us\":%llu}", (unsigned long long)result.stats.tasksStolen, (unsigned long long)result.stats.scheduleBlockedTime);
+	}
+	else
+	{
+		if(first)
+		{
+			fprintf(out, "workload,threads,producers,tasks,seconds,tasks_per_sec,ns_per_task,overhead_ns_per_task,wait_p50_ns,wait_p99_ns,wait_p999_ns,run_p50_ns,run_p99_ns,run_p999_ns,steals,schedule_blocked_us\n");
+		}
+		fprintf(out, "%s,%u,%u,%llu,%.6f,%.1f,%.1f,%.1f,", name, threads, producers, tasks, result.seconds, tasksPerSec, nsPerTask, result.overhead);
+		fprintf(out, "%llu,%llu,%llu,%llu,%llu,%llu,", (unsigned long long)result.wait.p50, (unsigned long long)result.wait.p99, (unsigned long long)result.wait.p999, (unsigned long long)result.run.p50, (unsigned long long)result.run.p99, (unsigned long long)result.run.p999);
+		fprintf(out, "%llu,%llu\n", (unsigned long long)result.stats.tasksStolen, (unsigned long long)result.stats.scheduleBlockedTime);
+	}
+
+	fflush(out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if(!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	uint32_t vMajor, vMinor, vPatch;
+	bool bDebug;
+	const char *date = MTHREADPOOL_NS::getVersionInfo(vMajor, vMinor, vPatch, bDebug);
+	fprintf(stderr, "MThreadPool Benchmark, using MThreadPool library v%u.%02u-%u, built on %s, %s\n\n", vMajor, vMinor, vPatch, date, bDebug ? "Debug" : "Release");
+
+	FILE *const out = options.output ? fopen(options.output, "w") : stdout;
+	if(!out)
+	{
+		fprintf(stderr, "Failed to open output file \"%s\"!\n", options.output);
+		return 1;
+	}
+
+	//The memory workload needs a buffer that does not fit into the caches; it is touched once up front
+	g_memory = new uint64_t[MEMORY_SIZE / sizeof(uint64_t)];
+	for(size_t i = 0; i < MEMORY_SIZE / sizeof(uint64_t); i++)
+	{
+		g_memory[i] = i;
+	}
+
+	bool first = true;
+	if(options.json)
+	{
+		fprintf(out, "[");
+	}
+
+	for(size_t w = 0; w < options.workloads.size(); w++)
+	{
+		const Workload *workload = WORKLOADS;
+		while(workload->name && (options.workloads[w] != workload->name))
+		{
+			workload++;
+		}
+		if(!workload->name)
+		{
+			fprintf(stderr, "Unknown workload \"%s\", skipping!\n", options.workloads[w].c_str());
+			continue;
+		}
+
+		for(size_t t = 0; t < options.threads.size(); t++)
+		{
+			for(size_t p = 0; p < (workload->forkJoin ? 1 : options.producers.size()); p++)
+			{
+				const uint32_t producers = workload->forkJoin ? 1 : std::max(options.producers[p], 1U);
+				for(uint32_t r = 0; r < options.repeat; r++)
+				{
+					fprintf(stderr, "Running \"%s\" with %u thread(s) and %u producer(s)...\n", workload->name, options.threads[t], producers);
+					Result result;
+					if(runBenchmark(workload, options, options.threads[t], producers, result))
+					{
+						writeResult(out, options.json, first, workload->name, options.threads[t], producers, result);
+						first = false;
+					}
+				}
+			}
+		}
+	}
+
+	if(options.json)
+	{
+		fprintf(out, "\n]\n");
+	}
+
+	if(out != stdout)
+	{
+		fclose(out);
+	}
+
+	delete [] g_memory;
+	fprintf(stderr, "\nDone.\n");
+	return 0;
+}
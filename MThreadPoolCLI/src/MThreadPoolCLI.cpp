@@ -99,7 +99,11 @@ public:
 // Main
 ///////////////////////////////////////////////////////////////////////////////
 
+#ifdef _WIN32
 int wmain(int argc, wchar_t* argv[])
+#else
+int main(void)
+#endif
 {
 	static const int MAX_RUNS = 8;
 	static const int TASK_COUNT = 256;
@@ -113,7 +117,7 @@ int wmain(int argc, wchar_t* argv[])
 	
 	MyListener listener;
 
-	MyTask **tasks = new MyTask*[TASK_COUNT];
+	MTHREADPOOL_NS::ITask **tasks = new MTHREADPOOL_NS::ITask*[TASK_COUNT];
 	for(int i = 0; i < TASK_COUNT; i++)
 	{
 		tasks[i] = new MyTask(i);
@@ -126,12 +130,9 @@ int wmain(int argc, wchar_t* argv[])
 		MTHREADPOOL_NS::IPool *pool = MTHREADPOOL_NS::allocatePool();
 		pool->addListener(&listener);
 
-		for(int i = 0; i < TASK_COUNT; i++)
+		if(!pool->scheduleBatch(tasks, TASK_COUNT))
 		{
-			if(!pool->schedule(tasks[i]))
-			{
-				printf("Scheduling has failed!\n");
-			}
+			printf("Scheduling has failed!\n");
 		}
 
 		printf("Synchronizing...\n");
@@ -0,0 +1,1663 @@
+///////////////////////////////////////////////////////////////////////////////
+// MThreadPool - MuldeR's Thread Pool
+// Copyright (C) 2014 LoRd_MuldeR <MuldeR2@GMX.de>. All rights reserved.
+// http://www.muldersoft.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version, but always including the *additional*
+// restrictions defined in the "License.txt" file.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+
+#include "MThreadPoolAPI.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/stat.h>
+#include "PlatformSupport.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace MTHREADPOOL_NS;
+
+#define CHECK(X) do \
+{ \
+	if(!(X)) \
+	{ \
+		fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #X); \
+		return false; \
+	} \
+} \
+while(0)
+
+static const uint32_t POLL_LIMIT = 5000; /*milliseconds*/
+
+static void sleepFor(const uint32_t &milliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+static uint64_t elapsedSince(const std::chrono::steady_clock::time_point &start)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+template<typename Condition>
+static bool pollUntil(const Condition &condition)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while(!condition())
+	{
+		if(elapsedSince(start) > POLL_LIMIT)
+		{
+			return false;
+		}
+		sleepFor(1);
+	}
+	return true;
+}
+
+class CountingTask : public ITask
+{
+public:
+	CountingTask(std::atomic<uint32_t> &counter) : m_counter(counter) {}
+
+	virtual void run(void)
+	{
+		m_counter++;
+	}
+
+private:
+	CountingTask &operator=(const CountingTask&) = delete;
+	std::atomic<uint32_t> &m_counter;
+};
+
+class OrderTask : public ITask
+{
+public:
+	OrderTask(std::atomic<uint32_t> &clock) : m_clock(clock), position(0) {}
+
+	virtual void run(void)
+	{
+		position = ++m_clock;
+	}
+
+private:
+	OrderTask &operator=(const OrderTask&) = delete;
+	std::atomic<uint32_t> &m_clock;
+
+public:
+	uint32_t position;
+};
+
+//Keeps the only worker of a pool busy, until it is opened
+class Gate : public ITask
+{
+public:
+	Gate(void) : m_open(false), m_entered(false) {}
+
+	virtual void run(void)
+	{
+		m_entered = true;
+		while(!m_open.load())
+		{
+			sleepFor(1);
+		}
+	}
+
+	bool entered(void) const { return m_entered.load(); }
+	void open(void) { m_open = true; }
+
+private:
+	std::atomic<bool> m_open;
+	std::atomic<bool> m_entered;
+};
+
+static bool blockWorker(IPool *const pool, Gate &gate)
+{
+	Gate *const g = &gate;
+	return pool->schedule(&gate) && pollUntil([g]() { return g->entered(); });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests
+///////////////////////////////////////////////////////////////////////////////
+
+static bool testSchedule(void)
+{
+	static const uint32_t PRODUCER_COUNT = 4;
+
+	IPool *const pool = allocatePool(4);
+	CHECK(pool);
+
+	//Several threads fill the queue at the same time
+	std::atomic<uint32_t> counter(0), failed(0);
+	std::vector<CountingTask> tasks(1000, CountingTask(counter));
+	std::vector<std::thread> producers;
+	for(uint32_t i = 0; i < PRODUCER_COUNT; i++)
+	{
+		producers.push_back(std::thread([pool, &tasks, &failed, i]()
+		{
+			for(size_t j = i; j < tasks.size(); j += PRODUCER_COUNT)
+			{
+				if(!pool->schedule(&tasks[j]))
+				{
+					failed++;
+				}
+			}
+		}));
+	}
+	for(size_t i = 0; i < producers.size(); i++)
+	{
+		producers[i].join();
+	}
+
+	CHECK(pool->wait());
+	CHECK(failed.load() == 0);
+	CHECK(counter.load() == 1000);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testBoundedQueue(void)
+{
+	static const uint32_t QUEUE_LENGTH = 8;
+
+	IPool *const pool = allocatePool(1, QUEUE_LENGTH);
+	CHECK(pool);
+
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+
+	//With the only worker blocked, the queue fills up and trySchedule() has to give up
+	std::atomic<uint32_t> counter(0);
+	std::vector<CountingTask> tasks(4 * QUEUE_LENGTH, CountingTask(counter));
+	uint32_t accepted = 0;
+	while((accepted < tasks.size()) && pool->trySchedule(&tasks[accepted]))
+	{
+		accepted++;
+	}
+	CHECK(accepted >= 1);
+	CHECK(accepted < tasks.size());
+
+	//A blocking schedule() gets through once the worker makes room
+	std::thread producer([pool, &tasks, accepted]() { pool->schedule(&tasks[accepted]); });
+	sleepFor(20);
+	gate.open();
+	producer.join();
+
+	CHECK(pool->wait());
+	CHECK(counter.load() == accepted + 1);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+//Schedules its children from within the pool, so in work-stealing mode they go to the deque of the worker that runs it
+class SpawnTask : public ITask
+{
+public:
+	SpawnTask(IPool *const pool, std::vector<CountingTask> &children, std::atomic<uint32_t> &failed) : m_pool(pool), m_children(children), m_failed(failed) {}
+
+	virtual void run(void)
+	{
+		for(size_t i = 0; i < m_children.size(); i++)
+		{
+			if(!m_pool->schedule(&m_children[i]))
+			{
+				m_failed++;
+			}
+		}
+	}
+
+private:
+	SpawnTask &operator=(const SpawnTask&) = delete;
+	IPool *const m_pool;
+	std::vector<CountingTask> &m_children;
+	std::atomic<uint32_t> &m_failed;
+};
+
+static bool testWorkStealing(void)
+{
+	static const uint32_t CHILD_COUNT = 10000;
+
+	IPool *const pool = allocatePool(4, 0, POOL_FLAG_WORK_STEALING);
+	CHECK(pool);
+
+	//Children go to the deque of the worker that spawns them, the other workers have to steal
+	std::atomic<uint32_t> counter(0), failed(0);
+	std::vector<std::vector<CountingTask>> children(4, std::vector<CountingTask>(CHILD_COUNT, CountingTask(counter)));
+	std::vector<SpawnTask> spawners;
+	for(size_t i = 0; i < children.size(); i++)
+	{
+		spawners.push_back(SpawnTask(pool, children[i], failed));
+	}
+	for(size_t i = 0; i < spawners.size(); i++)
+	{
+		CHECK(pool->schedule(&spawners[i]));
+	}
+
+	CHECK(pool->wait());
+	CHECK(failed.load() == 0);
+	CHECK(counter.load() == 4 * CHILD_COUNT);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testLocalSignals(void)
+{
+	static const uint32_t CHILD_COUNT = 100000;
+
+	IPool *const pool = allocatePool(2, 0, POOL_FLAG_WORK_STEALING);
+	CHECK(pool);
+
+	//A run that leaves signals behind makes the pool burn CPU time afterwards; a single quiet run is enough to rule that out,
+	//because background noise (e.g. from a sanitizer) does not show up every time, while the signals would
+	bool quiet = false;
+	for(uint32_t attempt = 0; (attempt < 3) && (!quiet); attempt++)
+	{
+		//Both workers fill their own deque while the other one is busy, so there is nobody to wake up for the children
+		std::atomic<uint32_t> counter(0), failed(0), spawned(0);
+		std::vector<std::vector<CountingTask>> children(2, std::vector<CountingTask>(CHILD_COUNT, CountingTask(counter)));
+		for(size_t i = 0; i < children.size(); i++)
+		{
+			std::vector<CountingTask> *const tasks = &children[i];
+			CHECK(pool->schedule([pool, tasks, &failed, &spawned]()
+			{
+				for(size_t j = 0; j < tasks->size(); j++)
+				{
+					if(!pool->schedule(&(*tasks)[j]))
+					{
+						failed++;
+					}
+				}
+				spawned++;
+				pollUntil([&spawned]() { return spawned.load() == 2; });
+			}));
+		}
+		CHECK(pool->wait());
+		CHECK(failed.load() == 0);
+		CHECK(counter.load() == 2 * CHILD_COUNT);
+
+		const std::clock_t start = std::clock();
+		sleepFor(100);
+		quiet = (double(std::clock() - start) / CLOCKS_PER_SEC) < 0.01;
+	}
+	CHECK(quiet);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testWaitTask(void)
+{
+	static const uint32_t TASK_COUNT = 100;
+
+	IPool *const pool = allocatePool(1, 2 * TASK_COUNT);
+	CHECK(pool);
+
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+
+	std::vector<std::atomic<uint32_t>> counters(TASK_COUNT);
+	std::vector<CountingTask> tasks;
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		counters[i] = 0;
+		tasks.push_back(CountingTask(counters[i]));
+	}
+
+	//A task that is still pending is not queued a second time
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		CHECK(pool->schedule(&tasks[i]));
+	}
+	CHECK(pool->schedule(&tasks[0]));
+	gate.open();
+
+	//Waiting for a task returns once that task has finished, in whatever order the tasks are waited for
+	for(uint32_t i = TASK_COUNT; i > 0; i--)
+	{
+		CHECK(pool->wait(&tasks[i - 1]));
+		CHECK(counters[i - 1].load() == 1);
+	}
+
+	//Once finished, the same task can be scheduled again
+	CHECK(pool->schedule(&tasks[0]));
+	CHECK(pool->wait(&tasks[0]));
+	CHECK(counters[0].load() == 2);
+
+	//A task that has never been scheduled is not waited for
+	std::atomic<uint32_t> idle(0);
+	CountingTask unknown(idle);
+	CHECK(pool->wait(&unknown));
+	CHECK(idle.load() == 0);
+
+	CHECK(pool->wait());
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testBatch(void)
+{
+	static const uint32_t QUEUE_LENGTH = 8;
+
+	IPool *const pool = allocatePool(4);
+	CHECK(pool);
+
+	//A batch that is much larger than the queue gets through in chunks
+	std::atomic<uint32_t> counter(0);
+	std::vector<CountingTask> tasks(1000, CountingTask(counter));
+	std::vector<ITask*> batch;
+	for(size_t i = 0; i < tasks.size(); i++)
+	{
+		batch.push_back(&tasks[i]);
+	}
+	CHECK(pool->scheduleBatch(&batch[0], batch.size()));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 1000);
+
+	CHECK(destroyPool(pool));
+
+	IPool *const bounded = allocatePool(1, QUEUE_LENGTH);
+	CHECK(bounded);
+
+	Gate gate;
+	CHECK(blockWorker(bounded, gate));
+
+	//With the only worker blocked, tryScheduleBatch() takes the leading tasks that fit
+	std::atomic<uint32_t> partial(0);
+	std::vector<CountingTask> more(4 * QUEUE_LENGTH, CountingTask(partial));
+	std::vector<ITask*> pointers;
+	for(size_t i = 0; i < more.size(); i++)
+	{
+		pointers.push_back(&more[i]);
+	}
+	size_t scheduled = 0;
+	CHECK(bounded->tryScheduleBatch(&pointers[0], pointers.size(), scheduled));
+	CHECK(scheduled >= 1);
+	CHECK(scheduled < pointers.size());
+
+	//The rest gets through once the worker makes room
+	gate.open();
+	CHECK(bounded->scheduleBatch(&pointers[scheduled], pointers.size() - scheduled));
+	CHECK(bounded->wait());
+	CHECK(partial.load() == more.size());
+
+	CHECK(destroyPool(bounded));
+	return true;
+}
+
+//Captured by value, so that a callable has a known size and its copy can be checked
+template<size_t SIZE>
+class Payload
+{
+public:
+	Payload(void)
+	{
+		for(size_t i = 0; i < SIZE; i++)
+		{
+			m_bytes[i] = uint8_t(i * 7);
+		}
+	}
+
+	void check(std::atomic<uint32_t> &counter, std::atomic<uint32_t> &broken) const
+	{
+		for(size_t i = 0; i < SIZE; i++)
+		{
+			if(m_bytes[i] != uint8_t(i * 7))
+			{
+				broken++;
+				break;
+			}
+		}
+		counter++;
+	}
+
+private:
+	uint8_t m_bytes[SIZE];
+};
+
+#ifdef _MSC_VER
+#define ALIGNED(X) __declspec(align(X))
+#else
+#define ALIGNED(X) __attribute__((aligned(X)))
+#endif
+
+struct ALIGNED(16) Block16 { uint8_t bytes[16]; };
+struct ALIGNED(64) Block64 { uint8_t bytes[64]; };
+
+//Captured by value, so that the callable inherits the alignment of the block
+template<typename T>
+class Aligned
+{
+public:
+	bool check(void) const
+	{
+		return (reinterpret_cast<uintptr_t>(&m_block) % std::alignment_of<T>::value) == 0;
+	}
+
+private:
+	T m_block;
+};
+
+static bool testLambdas(void)
+{
+	IPool *const pool = allocatePool(2, 0, POOL_FLAG_WORK_STEALING);
+	CHECK(pool);
+
+	//Small callables fit into the shared slots, larger ones spill to the size classes or to the heap
+	std::atomic<uint32_t> counter(0), broken(0);
+	const Payload<16> small;
+	const Payload<1000> medium;
+	const Payload<10000> large;
+	for(uint32_t i = 0; i < 100; i++)
+	{
+		CHECK(pool->schedule([&counter, &broken, small]() { small.check(counter, broken); }));
+		CHECK(pool->schedule([&counter, &broken, medium]() { medium.check(counter, broken); }));
+		CHECK(pool->schedule([&counter, &broken, large]() { large.check(counter, broken); }));
+	}
+	CHECK(pool->wait());
+	CHECK(counter.load() == 300);
+
+	//From within the pool, spilled blocks are recycled through the worker's own free list
+	CHECK(pool->schedule([pool, &counter, &broken, medium]()
+	{
+		for(uint32_t i = 0; i < 100; i++)
+		{
+			if(!pool->schedule([&counter, &broken, medium]() { medium.check(counter, broken); }))
+			{
+				broken++;
+			}
+		}
+	}));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 400);
+	CHECK(broken.load() == 0);
+
+	//Callables that are aligned more strictly than the pool's memory get a block of their own
+	const Aligned<Block16> aligned16 = Aligned<Block16>();
+	const Aligned<Block64> aligned64 = Aligned<Block64>();
+	for(uint32_t i = 0; i < 100; i++)
+	{
+		CHECK(pool->schedule([&counter, &broken, aligned16]() { broken += aligned16.check() ? 0 : 1; counter++; }));
+		CHECK(pool->schedule([&counter, &broken, aligned64]() { broken += aligned64.check() ? 0 : 1; counter++; }));
+	}
+	CHECK(pool->wait());
+	CHECK(counter.load() == 600);
+	CHECK(broken.load() == 0);
+
+	//The captured state is destroyed once the task has run
+	std::shared_ptr<uint32_t> shared(new uint32_t(42));
+	CHECK(pool->schedule([shared, &counter]() { counter += *shared; }));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 642);
+	CHECK(shared.use_count() == 1);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testFutures(void)
+{
+	IPool *const pool = allocatePool(2);
+	CHECK(pool);
+
+	Future<int> value = pool->submit([]() { return 42; });
+	CHECK(value.valid());
+	CHECK(value.get() == 42);
+	CHECK(!value.valid());
+
+	Future<std::string> text = pool->submit([]() { return std::string("MThreadPool"); });
+	CHECK(text.wait());
+	CHECK(text.get() == "MThreadPool");
+
+	Future<void> failing = pool->submit([]() { throw std::runtime_error("Expected failure"); });
+	bool caught = false;
+	try
+	{
+		failing.get();
+	}
+	catch(std::runtime_error&)
+	{
+		caught = true;
+	}
+	CHECK(caught);
+
+	//A future that is dropped without get() releases its task
+	{
+		Future<int> dropped = pool->submit([]() { return 1; });
+	}
+	CHECK(pool->wait());
+
+	//A future may outlive its pool
+	Future<int> late = pool->submit([]() { return 7; });
+	Future<int> unused = pool->submit([]() { return 8; });
+	CHECK(pool->wait());
+	CHECK(destroyPool(pool));
+	CHECK(late.wait());
+	CHECK(!late.cancel());
+	CHECK(late.get() == 7);
+	return true;
+}
+
+static bool testTaskGraph(void)
+{
+	IPool *const pool = allocatePool(4);
+	CHECK(pool);
+
+	ITaskGraph *const graph = allocateGraph();
+	CHECK(graph);
+
+	//Diamond: a -> (b, c) -> d
+	std::atomic<uint32_t> clock(0);
+	OrderTask a(clock), b(clock), c(clock), d(clock);
+	CHECK(graph->addDependency(&a, &b));
+	CHECK(graph->addDependency(&a, &c));
+	CHECK(graph->addDependency(&b, &d));
+	CHECK(graph->addDependency(&c, &d));
+	CHECK(!graph->addDependency(&a, &a));
+
+	//The same graph can be executed again, once it has completed
+	for(uint32_t run = 0; run < 3; run++)
+	{
+		CHECK(pool->scheduleGraph(graph));
+		CHECK(pool->wait(graph));
+		CHECK(a.position < b.position);
+		CHECK(a.position < c.position);
+		CHECK(b.position < d.position);
+		CHECK(c.position < d.position);
+		CHECK(clock.load() == 4 * (run + 1));
+	}
+
+	//A cycle is rejected
+	CHECK(graph->addDependency(&d, &a));
+	CHECK(!pool->scheduleGraph(graph));
+
+	CHECK(destroyGraph(graph));
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testParallel(void)
+{
+	static const size_t COUNT = 1000000;
+
+	IPool *const pool = allocatePool(4, 0, POOL_FLAG_WORK_STEALING);
+	CHECK(pool);
+
+	std::vector<uint8_t> visited(COUNT, 0);
+	parallelFor(pool, 0, COUNT, [&visited](const size_t &first, const size_t &last)
+	{
+		for(size_t i = first; i < last; i++)
+		{
+			visited[i]++;
+		}
+	});
+	for(size_t i = 0; i < COUNT; i++)
+	{
+		CHECK(visited[i] == 1);
+	}
+
+	const uint64_t sum = parallelReduce(pool, 0, COUNT, uint64_t(0),
+		[](const size_t &first, const size_t &last, const uint64_t &init) { uint64_t value = init; for(size_t i = first; i < last; i++) value += i; return value; },
+		[](const uint64_t &lower, const uint64_t &upper) { return lower + upper; }, 64);
+	CHECK(sum == (uint64_t(COUNT) * (COUNT - 1)) / 2);
+
+	//The first exception thrown by the body is passed on to the caller
+	bool caught = false;
+	try
+	{
+		parallelFor(pool, 0, COUNT, [](const size_t &first, const size_t &last)
+		{
+			if((first <= (COUNT / 2)) && ((COUNT / 2) < last))
+			{
+				throw std::runtime_error("Expected failure");
+			}
+		});
+	}
+	catch(std::runtime_error&)
+	{
+		caught = true;
+	}
+	CHECK(caught);
+
+	//Once there is nothing left to help with, the caller must sleep until the last sub-range is done, instead of spinning
+	bool quiet = false;
+	for(uint32_t attempt = 0; (attempt < 3) && (!quiet); attempt++)
+	{
+		std::atomic<bool> started(false);
+		const std::clock_t start = std::clock();
+		parallelFor(pool, 0, 2, [&started](const size_t &first, const size_t &)
+		{
+			if(first > 0)
+			{
+				started = true;
+				sleepFor(200);
+			}
+			else
+			{
+				pollUntil([&started]() { return started.load(); });
+			}
+		}, 1);
+		CHECK(started.load());
+		quiet = (double(std::clock() - start) / CLOCKS_PER_SEC) < 0.05;
+	}
+	CHECK(quiet);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+class SlowListener : public IListener
+{
+public:
+	virtual void taskLaunched(ITask *const /*task*/) {}
+	virtual void taskFinished(ITask *const /*task*/) { sleepFor(20); }
+};
+
+static bool testDestroyAfterJoin(void)
+{
+	//A slow listener keeps the worker busy between the end of run() and the finalization of the task
+	{
+		SlowListener listener;
+		IPool *const pool = allocatePool(1);
+		CHECK(pool);
+		CHECK(pool->addListener(&listener));
+
+		std::atomic<bool> done(false);
+		CHECK(pool->schedule([&done]() { done = true; }));
+		CHECK(pollUntil([&done]() { return done.load(); }));
+
+		CHECK(destroyPool(pool));
+	}
+
+	//The pool may be destroyed as soon as the join has been released, while the workers are still finalizing the tasks
+	for(uint32_t run = 0; run < 200; run++)
+	{
+		IPool *const pool = allocatePool(4, 0, POOL_FLAG_WORK_STEALING);
+		CHECK(pool);
+
+		const uint64_t sum = parallelReduce(pool, 0, 10000, uint64_t(0),
+			[](const size_t &first, const size_t &last, const uint64_t &init) { return init + (last - first); },
+			[](const uint64_t &lower, const uint64_t &upper) { return lower + upper; }, 16);
+		CHECK(sum == 10000);
+
+		CHECK(destroyPool(pool));
+	}
+
+	return true;
+}
+
+static bool testCooperativeWait(void)
+{
+	IPool *const pool = allocatePool(1, 0, POOL_FLAG_COOPERATIVE_WAIT);
+	CHECK(pool);
+
+	//With a single worker, waiting for a nested task only works if the waiting worker runs it itself
+	std::atomic<uint32_t> counter(0);
+	CountingTask inner(counter);
+	CHECK(pool->schedule([pool, &inner, &counter]()
+	{
+		if(pool->schedule(&inner) && pool->wait(&inner))
+		{
+			counter++;
+		}
+	}));
+
+	CHECK(pool->wait());
+	CHECK(counter.load() == 2);
+
+	//The calling thread helps out, too
+	std::vector<CountingTask> tasks(1000, CountingTask(counter));
+	for(size_t i = 0; i < tasks.size(); i++)
+	{
+		CHECK(pool->schedule(&tasks[i]));
+	}
+	CHECK(pool->wait(&tasks.back()));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 1002);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testCooperativeIdle(void)
+{
+	IPool *const pool = allocatePool(1, 0, POOL_FLAG_COOPERATIVE_WAIT);
+	CHECK(pool);
+
+	//The only worker is stuck until a task runs that is queued only after the waiting thread has been idle for a while
+	std::atomic<bool> entered(false), released(false), stuck(true);
+	std::thread::id runner;
+	CHECK(pool->schedule([&entered, &released, &stuck]()
+	{
+		entered = true;
+		stuck = !pollUntil([&released]() { return released.load(); });
+	}));
+	CHECK(pollUntil([&entered]() { return entered.load(); }));
+
+	std::thread producer([pool, &released, &runner]()
+	{
+		sleepFor(100);
+		pool->schedule([&released, &runner]() { runner = std::this_thread::get_id(); released = true; });
+	});
+
+	CHECK(pool->wait());
+	producer.join();
+	CHECK(!stuck.load());
+	CHECK(runner == std::this_thread::get_id());
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+//Schedules its successor until the chain has reached its length, so there is exactly one task at a time
+class ChainTask : public ITask
+{
+public:
+	ChainTask(IPool *const pool, std::vector<ChainTask> &chain, const size_t &index, std::atomic<uint32_t> &counter) : m_pool(pool), m_chain(chain), m_index(index), m_counter(counter) {}
+
+	virtual void run(void)
+	{
+		m_counter++;
+		if((m_index + 1) < m_chain.size())
+		{
+			m_pool->schedule(&m_chain[m_index + 1]);
+		}
+	}
+
+private:
+	ChainTask &operator=(const ChainTask&) = delete;
+	IPool *const m_pool;
+	std::vector<ChainTask> &m_chain;
+	const size_t m_index;
+	std::atomic<uint32_t> &m_counter;
+};
+
+static bool testSpinThenPark(void)
+{
+	static const uint32_t SPIN_COUNTS[][2] = { { 0, 0 }, { 100, 0 }, { 0, 10 }, { 10000, 100 } };
+
+	for(size_t config = 0; config < (sizeof(SPIN_COUNTS) / sizeof(SPIN_COUNTS[0])); config++)
+	{
+		PoolConfig options;
+		options.spinCount = SPIN_COUNTS[config][0];
+		options.yieldCount = SPIN_COUNTS[config][1];
+		IPool *const pool = allocatePool(4, 0, 0, options);
+		CHECK(pool);
+
+		//Bursts of different size, with pauses in between that let the workers go from spinning to parking
+		std::atomic<uint32_t> counter(0);
+		std::vector<CountingTask> tasks(8, CountingTask(counter));
+		uint32_t expected = 0;
+		for(uint32_t round = 0; round < 50; round++)
+		{
+			const uint32_t burst = 1 + (round % tasks.size());
+			for(uint32_t i = 0; i < burst; i++)
+			{
+				CHECK(pool->schedule(&tasks[i]));
+			}
+			expected += burst;
+			CHECK(pool->wait());
+			CHECK(counter.load() == expected);
+			sleepFor(round % 3);
+		}
+
+		//A task that schedules the next one, while the other workers are spinning or parked
+		std::atomic<uint32_t> links(0);
+		std::vector<ChainTask> chain;
+		for(size_t i = 0; i < 1000; i++)
+		{
+			chain.push_back(ChainTask(pool, chain, i, links));
+		}
+		CHECK(pool->schedule(&chain[0]));
+		CHECK(pool->wait());
+		CHECK(links.load() == chain.size());
+
+		CHECK(destroyPool(pool));
+	}
+
+	return true;
+}
+
+static bool testPriority(void)
+{
+	IPool *const pool = allocatePool(1);
+	CHECK(pool);
+
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+
+	std::atomic<uint32_t> clock(0);
+	OrderTask low(clock), normal(clock), high(clock);
+	CHECK(pool->schedule(&low, TASK_PRIORITY_LOW));
+	CHECK(pool->schedule(&normal, TASK_PRIORITY_NORMAL));
+	CHECK(pool->schedule(&high, TASK_PRIORITY_HIGH));
+	CHECK(!pool->schedule(&high, TASK_PRIORITY_COUNT));
+
+	gate.open();
+	CHECK(pool->wait());
+	CHECK(high.position == 1);
+	CHECK(normal.position == 2);
+	CHECK(low.position == 3);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testTimers(void)
+{
+	IPool *const pool = allocatePool(2);
+	CHECK(pool);
+
+	//A one-shot timer does not fire early, and the task counts as pending in the meantime
+	std::atomic<uint32_t> delayed(0);
+	CountingTask once(delayed);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CHECK(pool->scheduleAfter(&once, 50));
+	CHECK(pool->wait(&once));
+	CHECK(elapsedSince(start) >= 45);
+	CHECK(delayed.load() == 1);
+
+	//A periodic timer keeps firing until it is cancelled
+	std::atomic<uint32_t> periodic(0);
+	CountingTask every(periodic);
+	CHECK(pool->scheduleEvery(&every, 5));
+	CHECK(pollUntil([&periodic]() { return periodic.load() >= 3; }));
+	CHECK(pool->cancel(&every));
+	CHECK(pool->wait());
+	const uint32_t fired = periodic.load();
+	sleepFor(30);
+	CHECK(periodic.load() == fired);
+
+	//A one-shot timer can be cancelled before it fires
+	std::atomic<uint32_t> cancelled(0);
+	CountingTask never(cancelled);
+	CHECK(pool->scheduleAfter(&never, 10000));
+	CHECK(pool->cancel(&never));
+	CHECK(pool->wait());
+	CHECK(cancelled.load() == 0);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testCooperativeTimers(void)
+{
+	IPool *const pool = allocatePool(2, 0, POOL_FLAG_COOPERATIVE_WAIT);
+	CHECK(pool);
+
+	//The waiting thread must not swallow the wake-up that is meant for the worker keeping an eye on the timers
+	std::atomic<uint32_t> counter(0);
+	for(uint32_t run = 0; run < 20; run++)
+	{
+		for(uint32_t i = 0; i < 1000; i++)
+		{
+			CHECK(pool->schedule([&counter]() { counter++; }));
+		}
+		CHECK(pool->wait());
+
+		CountingTask delayed(counter);
+		CHECK(pool->scheduleAfter(&delayed, 20));
+		CHECK(pool->wait(&delayed));
+	}
+
+	CHECK(counter.load() == 20 * 1001);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testNestedTimers(void)
+{
+	static const uint32_t FLAGS[] = { 0, POOL_FLAG_COOPERATIVE_WAIT, POOL_FLAG_COOPERATIVE_WAIT | POOL_FLAG_WORK_STEALING };
+
+	//Every worker waits for a delayed task from within a task, so no worker is left in the processing loop to fire the timers
+	for(size_t f = 0; f < sizeof(FLAGS) / sizeof(FLAGS[0]); f++)
+	{
+		for(uint32_t threadCount = 1; threadCount <= 2; threadCount++)
+		{
+			for(uint32_t delay = 0; delay <= 5; delay += 5)
+			{
+				IPool *const pool = allocatePool(threadCount, 0, FLAGS[f]);
+				CHECK(pool);
+
+				std::atomic<uint32_t> counter(0), failed(0);
+				for(uint32_t i = 0; i < threadCount; i++)
+				{
+					CHECK(pool->schedule([pool, delay, &counter, &failed]()
+					{
+						CountingTask leaf(counter);
+						if(!(pool->scheduleAfter(&leaf, delay) && pool->wait(&leaf)))
+						{
+							failed++;
+						}
+					}));
+				}
+
+				CHECK(pool->wait());
+				CHECK(failed.load() == 0);
+				CHECK(counter.load() == threadCount);
+
+				CHECK(destroyPool(pool));
+			}
+		}
+	}
+
+	return true;
+}
+
+//Runs until it sees that it has been cancelled
+class CancellableTask : public ITask
+{
+public:
+	CancellableTask(void) : m_started(false), m_stopped(false) {}
+
+	virtual void run(void)
+	{
+		m_started = true;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while((!isCancelled()) && (elapsedSince(start) <= POLL_LIMIT))
+		{
+			sleepFor(1);
+		}
+		m_stopped = isCancelled();
+	}
+
+	bool started(void) const { return m_started.load(); }
+	bool stopped(void) const { return m_stopped.load(); }
+
+private:
+	std::atomic<bool> m_started;
+	std::atomic<bool> m_stopped;
+};
+
+static bool testCancel(void)
+{
+	IPool *const pool = allocatePool(1);
+	CHECK(pool);
+
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+
+	//A queued task is dropped without running when its turn comes, it stays pending until then
+	std::atomic<uint32_t> counter(0);
+	CountingTask dropped(counter), kept(counter);
+	CHECK(pool->schedule(&dropped));
+	CHECK(pool->schedule(&kept));
+	CHECK(pool->cancel(&dropped));
+	CHECK(!pool->cancel(&dropped));
+
+	gate.open();
+	CHECK(pool->wait(&dropped));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 1);
+
+	//A running task is not interrupted, but gets to see the flag
+	CancellableTask running;
+	CHECK(pool->schedule(&running));
+	CHECK(pollUntil([&running]() { return running.started(); }));
+	CHECK(pool->cancel(&running));
+	CHECK(pool->wait(&running));
+	CHECK(running.stopped());
+	CHECK(!pool->cancel(&running));
+
+	//A cancelled task can be scheduled again
+	CHECK(pool->schedule(&dropped));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 2);
+
+	CHECK(destroyPool(pool));
+
+	//Racing with the workers, every task either runs or is dropped, never both
+	static const uint32_t TASK_COUNT = 10000;
+	IPool *const busy = allocatePool(4);
+	CHECK(busy);
+
+	std::atomic<uint32_t> ran(0);
+	std::vector<CountingTask> tasks(TASK_COUNT, CountingTask(ran));
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		CHECK(busy->schedule(&tasks[i]));
+	}
+	uint32_t cancelled = 0;
+	for(uint32_t i = TASK_COUNT; i > 0; i--)
+	{
+		cancelled += busy->cancel(&tasks[i - 1]) ? 1 : 0;
+	}
+	CHECK(busy->wait());
+
+	PoolStats stats;
+	CHECK(busy->getStats(stats));
+	CHECK(ran.load() + stats.tasksCancelled == TASK_COUNT);
+	CHECK(stats.tasksCancelled <= cancelled);
+
+	CHECK(destroyPool(busy));
+	return true;
+}
+
+static bool testElastic(void)
+{
+	PoolConfig options;
+	options.maxThreadCount = 4;
+	options.keepAlive = 100;
+	options.spawnLatency = 5;
+	IPool *const pool = allocatePool(1, 0, 0, options);
+	CHECK(pool);
+	CHECK(pool->getThreadCount() == 1);
+
+	//Tasks that wait in the queue for too long make the pool grow
+	std::atomic<uint32_t> counter(0), maxThreads(1);
+	for(uint32_t i = 0; i < 32; i++)
+	{
+		CHECK(pool->schedule([pool, &counter, &maxThreads]()
+		{
+			sleepFor(10);
+			const uint32_t threads = pool->getThreadCount();
+			uint32_t current = maxThreads.load();
+			while((threads > current) && (!maxThreads.compare_exchange_weak(current, threads)));
+			counter++;
+		}));
+	}
+
+	CHECK(pool->wait());
+	CHECK(counter.load() == 32);
+	CHECK(maxThreads.load() > 1);
+	CHECK(maxThreads.load() <= 4);
+
+	//Once idle for the keep-alive period, the extra workers go away again
+	CHECK(pollUntil([pool]() { return pool->getThreadCount() == 1; }));
+
+	CHECK(destroyPool(pool));
+
+	//The same load does not make the pool grow, if tasks are allowed to wait for longer than it takes to run them all
+	options.spawnLatency = 60000;
+	IPool *const patient = allocatePool(1, 0, 0, options);
+	CHECK(patient);
+
+	std::atomic<uint32_t> patientMax(1);
+	for(uint32_t i = 0; i < 32; i++)
+	{
+		CHECK(patient->schedule([patient, &patientMax]()
+		{
+			sleepFor(1);
+			const uint32_t threads = patient->getThreadCount();
+			uint32_t current = patientMax.load();
+			while((threads > current) && (!patientMax.compare_exchange_weak(current, threads)));
+		}));
+	}
+
+	CHECK(patient->wait());
+	CHECK(patientMax.load() == 1);
+
+	CHECK(destroyPool(patient));
+	return true;
+}
+
+static bool testBlockingRegion(void)
+{
+	IPool *const pool = allocatePool(1);
+	CHECK(pool);
+
+	//The only worker blocks on something that a later task provides, so a spare worker has to step in
+	std::atomic<bool> provided(false);
+	std::atomic<uint32_t> counter(0);
+	CHECK(pool->schedule([pool, &provided, &counter]()
+	{
+		BlockingRegion region(pool);
+		while(!provided.load())
+		{
+			sleepFor(1);
+		}
+		counter++;
+	}));
+	CHECK(pool->schedule([&provided, &counter]() { provided = true; counter++; }));
+
+	CHECK(pool->wait());
+	CHECK(counter.load() == 2);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool isPinned(void)
+{
+#ifdef __linux__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	return (sched_getaffinity(0, sizeof(cpu_set_t), &mask) == 0) && (CPU_COUNT(&mask) == 1);
+#else
+	return true;
+#endif
+}
+
+static bool testPinning(void)
+{
+	static const uint32_t FLAGS[] = { POOL_FLAG_PIN_COMPACT, POOL_FLAG_PIN_SCATTER, POOL_FLAG_PIN_CORES, POOL_FLAG_PIN_CORES | POOL_FLAG_WORK_STEALING };
+
+	for(size_t f = 0; f < sizeof(FLAGS) / sizeof(FLAGS[0]); f++)
+	{
+		IPool *const pool = allocatePool(4, 0, FLAGS[f]);
+		CHECK(pool);
+
+		//Every worker has been restricted to a single processor before it runs any task
+		std::atomic<uint32_t> counter(0), unpinned(0);
+		for(uint32_t i = 0; i < 100; i++)
+		{
+			CHECK(pool->schedule([&counter, &unpinned]()
+			{
+				if(!isPinned())
+				{
+					unpinned++;
+				}
+				counter++;
+			}));
+		}
+
+		CHECK(pool->wait());
+		CHECK(counter.load() == 100);
+		CHECK(unpinned.load() == 0);
+
+		CHECK(destroyPool(pool));
+	}
+
+	return true;
+}
+
+static bool testNuma(void)
+{
+	static const uint32_t FLAGS[] = { POOL_FLAG_NUMA, POOL_FLAG_NUMA | POOL_FLAG_WORK_STEALING, POOL_FLAG_NUMA | POOL_FLAG_WORK_STEALING | POOL_FLAG_COOPERATIVE_WAIT, POOL_FLAG_NUMA | POOL_FLAG_PIN_COMPACT };
+	static const uint32_t TASK_COUNT = 300;
+
+	for(size_t f = 0; f < sizeof(FLAGS) / sizeof(FLAGS[0]); f++)
+	{
+		IPool *const pool = allocatePool(3, 64, FLAGS[f]);
+		CHECK(pool);
+		CHECK(pool->getNodeCount() >= 1);
+
+		//Node queues, nested tasks and other priorities all get drained
+		std::atomic<uint32_t> counter(0), nodeCounter(0);
+		std::vector<CountingTask> tasks(TASK_COUNT, CountingTask(nodeCounter));
+		for(uint32_t i = 0; i < TASK_COUNT; i++)
+		{
+			CHECK(pool->scheduleOnNode(&tasks[i], 0));
+			CHECK(pool->schedule([pool, &counter]()
+			{
+				counter++;
+				pool->schedule([&counter]() { counter++; });
+			}));
+			CHECK(pool->schedule([&counter]() { counter++; }, TASK_PRIORITY_HIGH));
+		}
+
+		CHECK(pool->wait());
+		CHECK(counter.load() == 3 * TASK_COUNT);
+		CHECK(nodeCounter.load() == TASK_COUNT);
+
+		//There is no such node
+		CountingTask invalid(nodeCounter);
+		CHECK(!pool->scheduleOnNode(&invalid, pool->getNodeCount()));
+
+		CHECK(destroyPool(pool));
+	}
+
+	return true;
+}
+
+#ifdef __linux__
+
+static bool writeFile(const std::string &path, const char *const content)
+{
+	//Creates the missing directories along the way
+	for(size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+	{
+		mkdir(path.substr(0, pos).c_str(), 0700);
+	}
+
+	FILE *const file = fopen(path.c_str(), "w");
+	if(!file)
+	{
+		return false;
+	}
+	fputs(content, file);
+	fclose(file);
+	return true;
+}
+
+static bool testCgroupQuota(void)
+{
+	char temp[] = "/tmp/mthreadpool_cgroup_XXXXXX";
+	CHECK(mkdtemp(temp));
+
+	//cgroup v2, 1.5 processors are rounded up
+	const std::string v2 = std::string(temp) + "/v2";
+	CHECK(writeFile(v2 + "/proc/self/cgroup", "0::/app\n"));
+	CHECK(writeFile(v2 + "/sys/fs/cgroup/app/cpu.max", "150000 100000\n"));
+	CHECK(getProcessorQuota(v2.c_str()) == 2);
+
+	//cgroup v2, no limit
+	CHECK(writeFile(v2 + "/sys/fs/cgroup/app/cpu.max", "max 100000\n"));
+	CHECK(getProcessorQuota(v2.c_str()) == 0);
+
+	//cgroup v2, the tightest limit up the hierarchy wins
+	const std::string nested = std::string(temp) + "/nested";
+	CHECK(writeFile(nested + "/proc/self/cgroup", "0::/outer/inner\n"));
+	CHECK(writeFile(nested + "/sys/fs/cgroup/outer/cpu.max", "300000 100000\n"));
+	CHECK(writeFile(nested + "/sys/fs/cgroup/outer/inner/cpu.max", "max 100000\n"));
+	CHECK(getProcessorQuota(nested.c_str()) == 3);
+	CHECK(writeFile(nested + "/sys/fs/cgroup/outer/inner/cpu.max", "100000 100000\n"));
+	CHECK(getProcessorQuota(nested.c_str()) == 1);
+
+	//cgroup v1, the "cpu" controller may be mounted together with "cpuacct"
+	const std::string v1 = std::string(temp) + "/v1";
+	CHECK(writeFile(v1 + "/proc/self/cgroup", "5:memory:/app\n4:cpu,cpuacct:/app\n"));
+	CHECK(writeFile(v1 + "/sys/fs/cgroup/cpu,cpuacct/app/cpu.cfs_quota_us", "250000\n"));
+	CHECK(writeFile(v1 + "/sys/fs/cgroup/cpu,cpuacct/app/cpu.cfs_period_us", "100000\n"));
+	CHECK(getProcessorQuota(v1.c_str()) == 3);
+
+	//cgroup v1, a quota of -1 means no limit
+	CHECK(writeFile(v1 + "/sys/fs/cgroup/cpu,cpuacct/app/cpu.cfs_quota_us", "-1\n"));
+	CHECK(getProcessorQuota(v1.c_str()) == 0);
+
+	//No cgroup information at all
+	const std::string none = std::string(temp) + "/none";
+	CHECK(getProcessorQuota(none.c_str()) == 0);
+
+	const std::string command = std::string("rm -rf ") + temp;
+	CHECK(system(command.c_str()) == 0);
+	return true;
+}
+
+#endif //__linux__
+
+static bool testStats(void)
+{
+	IPool *const pool = allocatePool(2);
+	CHECK(pool);
+
+	std::atomic<uint32_t> counter(0);
+	std::vector<CountingTask> tasks(100, CountingTask(counter));
+	for(size_t i = 0; i < tasks.size(); i++)
+	{
+		CHECK(pool->schedule(&tasks[i]));
+	}
+	CHECK(pool->schedule([]() { throw std::runtime_error("Expected failure"); }));
+	CHECK(pool->wait());
+	CHECK(counter.load() == 100);
+
+	PoolStats stats;
+	CHECK(pool->getStats(stats));
+	CHECK(stats.tasksScheduled == 101);
+	CHECK(stats.tasksCompleted == 100);
+	CHECK(stats.tasksFailed == 1);
+	CHECK(stats.tasksCancelled == 0);
+	CHECK(stats.pendingTasks == 0);
+	CHECK(stats.queueDepth == 0);
+	CHECK(stats.workers.size() >= 2);
+
+	//The per-worker counters add up to the totals
+	uint64_t completed = 0, failed = 0;
+	for(size_t i = 0; i < stats.workers.size(); i++)
+	{
+		completed += stats.workers[i].tasksCompleted;
+		failed += stats.workers[i].tasksFailed;
+	}
+	CHECK(completed == 100);
+	CHECK(failed == 1);
+
+	//A cancelled task is counted as such, but never as completed
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+	Gate other;
+	CHECK(blockWorker(pool, other));
+	CountingTask dropped(counter);
+	CHECK(pool->schedule(&dropped));
+	CHECK(pool->cancel(&dropped));
+	gate.open();
+	other.open();
+	CHECK(pool->wait());
+
+	CHECK(pool->getStats(stats));
+	CHECK(stats.tasksCancelled == 1);
+	CHECK(stats.tasksCompleted == 102);
+	CHECK(counter.load() == 100);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testLatency(void)
+{
+	static const uint32_t TASK_COUNT = 50;
+
+	IPool *const pool = allocatePool(1, 2 * TASK_COUNT);
+	CHECK(pool);
+
+	//The tasks queue up behind the gate for a while
+	Gate gate;
+	CHECK(blockWorker(pool, gate));
+	std::atomic<uint32_t> counter(0);
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		CHECK(pool->schedule([&counter]() { sleepFor(1); counter++; }));
+	}
+	sleepFor(50);
+	gate.open();
+	CHECK(pool->wait());
+	CHECK(counter.load() == TASK_COUNT);
+
+	//The gate itself is included in the counts
+	LatencyStats run;
+	CHECK(pool->getLatency(LATENCY_RUN_TIME, run));
+	CHECK(run.count == TASK_COUNT + 1);
+	CHECK(run.min >= 900000);
+	CHECK(run.max >= 45000000);
+	CHECK((run.min <= run.p50) && (run.p50 <= run.p90) && (run.p90 <= run.p99) && (run.p99 <= run.p999) && (run.p999 <= run.max));
+
+	LatencyStats wait;
+	CHECK(pool->getLatency(LATENCY_QUEUE_WAIT, wait));
+	CHECK(wait.count == TASK_COUNT + 1);
+	CHECK(wait.max >= 45000000);
+	CHECK((wait.min <= wait.p50) && (wait.p50 <= wait.max));
+
+	CHECK(!pool->getLatency(LATENCY_KIND_COUNT, wait));
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+class CountingListener : public IListener
+{
+public:
+	CountingListener(void) : launched(0), finished(0) {}
+
+	virtual void taskLaunched(ITask *const /*task*/) { launched++; }
+	virtual void taskFinished(ITask *const /*task*/) { finished++; }
+
+	std::atomic<uint32_t> launched;
+	std::atomic<uint32_t> finished;
+};
+
+static bool testListeners(const uint32_t &flags)
+{
+	static const uint32_t TASK_COUNT = 1000;
+
+	IPool *const pool = allocatePool(4, 0, flags);
+	CHECK(pool);
+
+	CountingListener listener;
+	CHECK(pool->addListener(&listener));
+
+	std::atomic<uint32_t> counter(0);
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		CHECK(pool->schedule([&counter]() { counter++; }));
+	}
+	CHECK(pool->wait());
+
+	//Asynchronous listeners are called with a short delay
+	CHECK(pollUntil([&listener]() { return listener.finished.load() >= TASK_COUNT; }));
+	CHECK(listener.launched.load() == TASK_COUNT);
+	CHECK(listener.finished.load() == TASK_COUNT);
+
+	//No more calls after removal
+	CHECK(pool->removeListener(&listener));
+	CHECK(pool->schedule([&counter]() { counter++; }));
+	CHECK(pool->wait());
+	sleepFor(100);
+	CHECK(listener.launched.load() == TASK_COUNT);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testListenersSync(void)
+{
+	return testListeners(0);
+}
+
+static bool testListenersAsync(void)
+{
+	return testListeners(POOL_FLAG_ASYNC_LISTENERS);
+}
+
+static bool readFile(const char *const fileName, std::string &content)
+{
+	FILE *const file = fopen(fileName, "r");
+	if(!file)
+	{
+		return false;
+	}
+
+	char buffer[4096];
+	while(const size_t len = fread(buffer, 1, sizeof(buffer), file))
+	{
+		content.append(buffer, len);
+	}
+
+	fclose(file);
+	remove(fileName);
+	return true;
+}
+
+static bool testTrace(void)
+{
+	static const char *const FILE_NAME = "MThreadPoolTest.trace.json";
+	static const uint32_t TASK_COUNT = 20;
+
+	//Without the flag, there is nothing to dump
+	IPool *pool = allocatePool(2);
+	CHECK(pool);
+	CHECK(!pool->dumpTrace(FILE_NAME));
+	CHECK(destroyPool(pool));
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pool = allocatePool(2, 0, POOL_FLAG_TRACE);
+	CHECK(pool);
+
+	std::atomic<uint32_t> counter(0);
+	for(uint32_t i = 0; i < TASK_COUNT; i++)
+	{
+		CHECK(pool->schedule([&counter]() { counter++; }));
+	}
+	CHECK(pool->wait());
+	CHECK(counter.load() == TASK_COUNT);
+
+	//The trace points only exist in a build with MTHREADPOOL_TRACE, the flag is ignored otherwise
+	if(pool->dumpTrace(FILE_NAME))
+	{
+		std::string content;
+		CHECK(readFile(FILE_NAME, content));
+
+		CHECK(content.find("\"traceEvents\":[") != std::string::npos);
+		CHECK(content.find("\"name\":\"Worker #0\"") != std::string::npos);
+		CHECK(content.compare(content.size() - 4, 4, "\n]}\n") == 0);
+
+		uint32_t runs = 0;
+		for(size_t pos = content.find("\"name\":\"run\""); pos != std::string::npos; pos = content.find("\"name\":\"run\"", pos + 1))
+		{
+			runs++;
+		}
+		CHECK(runs == TASK_COUNT);
+
+		//Dumping while the workers keep on recording must not pick up events that are only half written
+		std::atomic<bool> stop(false);
+		std::thread producer([pool, &stop]()
+		{
+			while(!stop.load())
+			{
+				pool->schedule([]() {});
+			}
+		});
+		bool consistent = true;
+		for(uint32_t round = 0; (round < 10) && consistent; round++)
+		{
+			content.clear();
+			consistent = pool->dumpTrace(FILE_NAME) && readFile(FILE_NAME, content) && (content.compare(content.size() - 4, 4, "\n]}\n") == 0);
+			const double limit = double(elapsedSince(start) + 1) * 1000.0; /*microseconds*/
+			for(size_t pos = content.find("\"ts\":"); consistent && (pos != std::string::npos); pos = content.find("\"ts\":", pos + 1))
+			{
+				const double ts = atof(content.c_str() + pos + 5);
+				consistent = (ts >= 0.0) && (ts <= limit);
+			}
+		}
+		stop = true;
+		producer.join();
+		CHECK(consistent);
+	}
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+static bool testContention(void)
+{
+	static const uint32_t PRODUCER_COUNT = 8;
+	static const uint32_t TASK_COUNT = 2000;
+
+	IPool *const pool = allocatePool(2, 4);
+	CHECK(pool);
+
+	//The producers keep blocking on the full queue, the workers keep parking on the empty one
+	std::atomic<uint32_t> counter(0), failed(0);
+	std::vector<std::thread> producers;
+	for(uint32_t i = 0; i < PRODUCER_COUNT; i++)
+	{
+		producers.push_back(std::thread([pool, &counter, &failed]()
+		{
+			for(uint32_t j = 0; j < TASK_COUNT; j++)
+			{
+				if(!pool->schedule([&counter]() { counter++; }))
+				{
+					failed++;
+				}
+			}
+		}));
+	}
+	for(size_t i = 0; i < producers.size(); i++)
+	{
+		producers[i].join();
+	}
+
+	CHECK(pool->wait());
+	CHECK(failed.load() == 0);
+	CHECK(counter.load() == PRODUCER_COUNT * TASK_COUNT);
+
+	CHECK(destroyPool(pool));
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+class Test
+{
+public:
+	const char *name;
+	bool (*function)(void);
+};
+
+static const Test TESTS[] =
+{
+	{ "schedule",        testSchedule        },
+	{ "bounded_queue",   testBoundedQueue    },
+	{ "work_stealing",   testWorkStealing    },
+	{ "local_signals",   testLocalSignals    },
+	{ "wait_task",       testWaitTask        },
+	{ "batch",           testBatch           },
+	{ "lambdas",         testLambdas         },
+	{ "futures",         testFutures         },
+	{ "task_graph",      testTaskGraph       },
+	{ "parallel",        testParallel        },
+	{ "destroy_after_join", testDestroyAfterJoin },
+	{ "cooperative",     testCooperativeWait },
+	{ "coop_idle",       testCooperativeIdle },
+	{ "spin_then_park",  testSpinThenPark    },
+	{ "priority",        testPriority        },
+	{ "cancel",          testCancel          },
+	{ "timers",          testTimers          },
+	{ "timers_coop",     testCooperativeTimers },
+	{ "timers_nested",   testNestedTimers    },
+	{ "elastic",         testElastic         },
+	{ "blocking_region", testBlockingRegion  },
+	{ "pinning",         testPinning         },
+	{ "numa",            testNuma            },
+#ifdef __linux__
+	{ "cgroup_quota",    testCgroupQuota     },
+#endif
+	{ "stats",           testStats           },
+	{ "latency",         testLatency         },
+	{ "listeners_sync",  testListenersSync   },
+	{ "listeners_async", testListenersAsync  },
+	{ "trace",           testTrace           },
+	{ "contention",      testContention      },
+	{ NULL, NULL }
+};
+
+int main(int argc, char* argv[])
+{
+	//Without arguments, all tests are run; otherwise only those that have been named
+	uint32_t failed = 0, executed = 0;
+	for(const Test *test = TESTS; test->name; test++)
+	{
+		bool selected = (argc < 2);
+		for(int i = 1; i < argc; i++)
+		{
+			selected = selected || (strcmp(argv[i], test->name) == 0);
+		}
+
+		if(selected)
+		{
+			executed++;
+			printf("[%s]\n", test->name);
+			if(!test->function())
+			{
+				printf("FAILED: %s\n", test->name);
+				failed++;
+			}
+		}
+	}
+
+	if(executed < 1)
+	{
+		fprintf(stderr, "No such test!\n");
+		return 1;
+	}
+
+	printf("\n%u of %u test(s) passed.\n", executed - failed, executed);
+	return (failed > 0) ? 1 : 0;
+}
@@ -39,7 +39,7 @@ namespace sha1
     namespace // local
     {
         // Rotate an integer value to left.
-        inline const unsigned int rol(const unsigned int value,
+        inline unsigned int rol(const unsigned int value,
                 const unsigned int steps)
         {
             return ((value << steps) | (value >> (32 - steps)));